@@ -8,47 +8,696 @@ struct Post{
     string content;
 };
 
+// One page of a timeline. Pass nextCursor back to get the page after it;
+// it is 0 once there is nothing older.
+struct FeedPage{
+    vector<Post> posts;
+    int nextCursor;
+};
+
+// Append-only post store. Posts live in fixed-size chunks that never move
+// once allocated, in id order, so scans stream over contiguous memory.
+// Ids come from a counter and are never reused; slotOfId maps each one to
+// its slot. A delete only marks a tombstone, and compact() later rewrites
+// the chunks without the dead posts.
+class PostArena{
+private:
+    static constexpr size_t CHUNK_SIZE = 4096;
+    static constexpr uint32_t NO_SLOT = UINT32_MAX;
+
+    vector<vector<Post>> chunks;
+    vector<bool> tombstones;      // by slot
+    vector<uint32_t> slotOfId;    // by id - 1
+    size_t slots = 0;
+    size_t dead = 0;
+    int nextId = 1;
+
+    Post& at(size_t slot){
+        return chunks[slot / CHUNK_SIZE][slot % CHUNK_SIZE];
+    }
+
+    void append(Post post){
+        if(slots % CHUNK_SIZE == 0){
+            chunks.emplace_back();
+            chunks.back().reserve(CHUNK_SIZE);
+        }
+        slotOfId[post.id - 1] = slots;
+        chunks.back().push_back(move(post));
+        tombstones.push_back(false);
+        slots++;
+    }
+
+public:
+    int create(int userId, string content){
+        int postId = nextId++;
+        slotOfId.push_back(NO_SLOT);
+        append({postId, userId, move(content)});
+        return postId;
+    }
+
+    // Null if the post never existed or has been deleted.
+    const Post* find(int postId){
+        if(postId < 1 || postId >= nextId || slotOfId[postId - 1] == NO_SLOT) return nullptr;
+        return &at(slotOfId[postId - 1]);
+    }
+
+    bool remove(int postId){
+        if(!find(postId)) return false;
+        tombstones[slotOfId[postId - 1]] = true;
+        slotOfId[postId - 1] = NO_SLOT;
+        dead++;
+        return true;
+    }
+
+    // Worth compacting once tombstones outnumber live posts.
+    bool fragmented(){
+        return dead > CHUNK_SIZE && dead * 2 > slots;
+    }
+
+    void compact(){
+        vector<vector<Post>> old;
+        old.swap(chunks);
+        vector<bool> oldTombstones;
+        oldTombstones.swap(tombstones);
+        size_t oldSlots = slots;
+        slots = dead = 0;
+        for(size_t slot = 0; slot < oldSlots; slot++){
+            if(!oldTombstones[slot]) append(move(old[slot / CHUNK_SIZE][slot % CHUNK_SIZE]));
+        }
+    }
+
+    // Calls visit for every live post, oldest first.
+    template <typename Visit>
+    void forEach(Visit visit){
+        for(size_t slot = 0; slot < slots; slot++){
+            if(!tombstones[slot]) visit(at(slot));
+        }
+    }
+};
+
+// One direction of the follow graph. The bulk of the edges sit in CSR
+// form: sorted vertex keys, each owning a sorted run of a shared target
+// array, so a user's edges are read sequentially at 4 bytes apiece.
+// Changes go to small delta sets first and are folded into the arrays
+// once they outgrow an eighth of them.
+class Adjacency{
+private:
+    vector<int> keys;
+    vector<size_t> offsets;   // keys.size() + 1 entries
+    vector<int> targets;
+    set<pair<int, int>> added, removed;
+
+    // [begin, end) of u's run in targets.
+    pair<size_t, size_t> range(int u){
+        auto it = lower_bound(keys.begin(), keys.end(), u);
+        if(it == keys.end() || *it != u) return {0, 0};
+        size_t k = it - keys.begin();
+        return {offsets[k], offsets[k + 1]};
+    }
+
+    bool inBase(int u, int v){
+        auto [begin, end] = range(u);
+        return binary_search(targets.begin() + begin, targets.begin() + end, v);
+    }
+
+    static size_t countFrom(set<pair<int, int>>& edges, int u){
+        auto first = edges.lower_bound({u, INT_MIN});
+        return distance(first, edges.upper_bound({u, INT_MAX}));
+    }
+
+    // Every edge, sorted.
+    vector<pair<int, int>> allEdges(){
+        vector<pair<int, int>> edges;
+        edges.reserve(targets.size() + added.size());
+        auto extra = added.begin();
+        auto gone = removed.begin();
+        for(size_t k = 0; k < keys.size(); k++){
+            for(size_t i = offsets[k]; i < offsets[k + 1]; i++){
+                pair<int, int> edge{keys[k], targets[i]};
+                while(extra != added.end() && *extra < edge) edges.push_back(*extra++);
+                while(gone != removed.end() && *gone < edge) gone++;
+                if(gone != removed.end() && *gone == edge) continue;
+                edges.push_back(edge);
+            }
+        }
+        edges.insert(edges.end(), extra, added.end());
+        return edges;
+    }
+
+    // Replaces everything with the given sorted, duplicate-free edges.
+    void build(const vector<pair<int, int>>& edges){
+        keys.clear();
+        offsets.clear();
+        targets.clear();
+        added.clear();
+        removed.clear();
+        for(auto [u, v]: edges){
+            if(keys.empty() || keys.back() != u){
+                keys.push_back(u);
+                offsets.push_back(targets.size());
+            }
+            targets.push_back(v);
+        }
+        offsets.push_back(targets.size());
+        keys.shrink_to_fit();
+        offsets.shrink_to_fit();
+        targets.shrink_to_fit();
+    }
+
+    void maybeMerge(){
+        if(added.size() + removed.size() > max<size_t>(1024, targets.size() / 8)) build(allEdges());
+    }
+
+public:
+    bool contains(int u, int v){
+        if(added.count({u, v})) return true;
+        return !removed.count({u, v}) && inBase(u, v);
+    }
+
+    bool insert(int u, int v){
+        if(contains(u, v)) return false;
+        if(!removed.erase({u, v})) added.insert({u, v});
+        maybeMerge();
+        return true;
+    }
+
+    bool erase(int u, int v){
+        if(!contains(u, v)) return false;
+        if(!added.erase({u, v})) removed.insert({u, v});
+        maybeMerge();
+        return true;
+    }
+
+    size_t degree(int u){
+        auto [begin, end] = range(u);
+        return end - begin + countFrom(added, u) - countFrom(removed, u);
+    }
+
+    // Visits u's neighbours in ascending order. visit must not modify
+    // the graph.
+    template <typename Visit>
+    void forEach(int u, Visit visit){
+        auto [begin, end] = range(u);
+        auto extra = added.lower_bound({u, INT_MIN});
+        bool anyRemoved = countFrom(removed, u) > 0;
+        size_t i = begin;
+        while(i < end || (extra != added.end() && extra->first == u)){
+            if(i < end && (extra == added.end() || extra->first != u || targets[i] < extra->second)){
+                int v = targets[i++];
+                if(!anyRemoved || !removed.count({u, v})) visit(v);
+            }
+            else visit((extra++)->second);
+        }
+    }
+
+    // Adds many edges in one sort-and-rebuild instead of one at a time.
+    void bulkInsert(vector<pair<int, int>> edges){
+        sort(edges.begin(), edges.end());
+        vector<pair<int, int>> current = allEdges();
+        vector<pair<int, int>> merged;
+        merged.reserve(current.size() + edges.size());
+        std::merge(current.begin(), current.end(), edges.begin(), edges.end(), back_inserter(merged));
+        merged.erase(unique(merged.begin(), merged.end()), merged.end());
+        build(merged);
+    }
+};
+
+// Who follows whom, stored in both directions so fan-out walks a user's
+// followers as directly as a timeline walks their followees.
+class FollowGraph{
+private:
+    Adjacency following;
+    Adjacency followers;
+
+public:
+    bool follow(int followerId, int followeeId){
+        if(!following.insert(followerId, followeeId)) return false;
+        followers.insert(followeeId, followerId);
+        return true;
+    }
+
+    bool unfollow(int followerId, int followeeId){
+        if(!following.erase(followerId, followeeId)) return false;
+        followers.erase(followeeId, followerId);
+        return true;
+    }
+
+    bool isFollowing(int followerId, int followeeId){
+        return following.contains(followerId, followeeId);
+    }
+
+    size_t followerCount(int userId){
+        return followers.degree(userId);
+    }
+
+    template <typename Visit>
+    void forEachFollowee(int userId, Visit visit){
+        following.forEach(userId, visit);
+    }
+
+    template <typename Visit>
+    void forEachFollower(int userId, Visit visit){
+        followers.forEach(userId, visit);
+    }
+
+    // Loads (follower, followee) pairs; self-follows are dropped.
+    void bulkImport(vector<pair<int, int>> edges){
+        edges.erase(remove_if(edges.begin(), edges.end(), [](const pair<int, int>& edge){ return edge.first == edge.second; }), edges.end());
+        following.bulkInsert(edges);
+        for(auto& edge: edges) swap(edge.first, edge.second);
+        followers.bulkInsert(move(edges));
+    }
+};
+
+struct CacheStats{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t invalidations;
+
+    double hitRate() const{
+        return hits + misses ? (double)hits / (hits + misses) : 0;
+    }
+};
+
+// Rendered feed pages, shared rather than copied out to readers. Users are
+// spread over shards, each an LRU list under its own lock, and evicted
+// whole: one entry holds every page size a user has asked for. Pages are
+// only ever dropped, never patched; the writer invalidates exactly the
+// users whose feed it changed.
+class FeedCache{
+public:
+    typedef shared_ptr<const vector<Post>> Page;
+
+private:
+    static constexpr size_t SHARDS = 16;
+
+    struct Entry{
+        int userId;
+        vector<pair<size_t, Page>> pages;   // by page size
+    };
+
+    struct Shard{
+        mutex mtx;
+        size_t capacity = 0;
+        list<Entry> lru;                    // most recent first
+        unordered_map<int, list<Entry>::iterator> index;
+    };
+
+    array<Shard, SHARDS> shards;
+    size_t shardCount;
+    atomic<uint64_t> hits{0}, misses{0}, evictions{0}, invalidations{0};
+
+    Shard& shardFor(int userId){
+        return shards[hash<int>()(userId) % shardCount];
+    }
+
+public:
+    // capacity counts users, split as evenly as it goes over the shards. A
+    // capacity below SHARDS uses that many shards of one user each, so the
+    // cache never holds more than asked; 0 caches nothing.
+    FeedCache(size_t capacity) : shardCount(min(max<size_t>(capacity, 1), SHARDS)){
+        for(size_t i = 0; i < shardCount; i++){
+            shards[i].capacity = capacity / shardCount + (i < capacity % shardCount);
+        }
+    }
+
+    Page get(int userId, size_t limit){
+        Shard& shard = shardFor(userId);
+        lock_guard<mutex> lock(shard.mtx);
+        auto it = shard.index.find(userId);
+        if(it != shard.index.end()){
+            for(auto& [pageSize, page]: it->second->pages){
+                if(pageSize != limit) continue;
+                shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                hits++;
+                return page;
+            }
+        }
+        misses++;
+        return nullptr;
+    }
+
+    void put(int userId, size_t limit, Page page){
+        Shard& shard = shardFor(userId);
+        if(shard.capacity == 0) return;
+        lock_guard<mutex> lock(shard.mtx);
+        auto it = shard.index.find(userId);
+        if(it == shard.index.end()){
+            shard.lru.push_front({userId, {}});
+            it = shard.index.emplace(userId, shard.lru.begin()).first;
+            if(shard.lru.size() > shard.capacity){
+                shard.index.erase(shard.lru.back().userId);
+                shard.lru.pop_back();
+                evictions++;
+            }
+        }
+        else shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        for(auto& [pageSize, cached]: it->second->pages){
+            if(pageSize == limit){
+                cached = move(page);
+                return;
+            }
+        }
+        it->second->pages.push_back({limit, move(page)});
+    }
+
+    void invalidate(int userId){
+        Shard& shard = shardFor(userId);
+        lock_guard<mutex> lock(shard.mtx);
+        auto it = shard.index.find(userId);
+        if(it == shard.index.end()) return;
+        shard.lru.erase(it->second);
+        shard.index.erase(it);
+        invalidations++;
+    }
+
+    CacheStats stats(){
+        return {hits, misses, evictions, invalidations};
+    }
+};
+
 class Facebook{
 private:
-    unordered_map<int, unordered_set<int>>followers;
-    list<Post> posts;
-    unordered_map<int, list<Post> :: iterator> PostMap;
+    FollowGraph graph;
+    PostArena posts;
+
+    // Fan-out-on-write: createPost pushes the post id into the feed of the
+    // author and of everyone following them, so a read only walks its own
+    // feed. Feeds hold the newest feedLimit ids, newest first; ids grow
+    // with time, so ordering by id is ordering by recency. Authors with
+    // more than celebrityThreshold followers are not fanned out; readers
+    // merge their recent posts in at read time instead.
+    unordered_map<int, vector<int>> userPosts;
+    unordered_map<int, deque<int>> feeds;
+    unordered_set<int> trimmedFeeds;  // feeds that have dropped old ids to stay within feedLimit
+    unordered_map<int, unordered_set<int>> celebritiesFollowed;
+    size_t celebrityThreshold;
+    size_t feedLimit;
+    FeedCache cache;
+
+    bool isCelebrity(int userId){
+        return graph.followerCount(userId) > celebrityThreshold;
+    }
 
+    // A post by userId changes their feed and that of every follower,
+    // whether it reached them by fan-out or by read-time merging.
+    void invalidateAudience(int userId){
+        cache.invalidate(userId);
+        graph.forEachFollower(userId, [&](int fan){ cache.invalidate(fan); });
+    }
+
+    void pushToFeed(int userId, int postId){
+        deque<int>& feed = feeds[userId];
+        feed.push_front(postId);
+        if(feed.size() > feedLimit){
+            feed.pop_back();
+            trimmedFeeds.insert(userId);
+        }
+    }
+
+    // Up to limit live post ids of the author, newest first. Feed backfills
+    // ask for feedLimit + 1, so rebuildFeed sees when older posts were left
+    // out and marks the feed trimmed.
+    void recentPosts(int userId, size_t limit, vector<int>& ids){
+        auto it = userPosts.find(userId);
+        if(it == userPosts.end()) return;
+        size_t taken = 0;
+        for(auto post = it->second.rbegin(); post != it->second.rend() && taken < limit; post++){
+            if(posts.find(*post)){
+                ids.push_back(*post);
+                taken++;
+            }
+        }
+    }
+
+    // Replaces a feed with the newest feedLimit of the given ids.
+    void rebuildFeed(int userId, vector<int>& ids){
+        sort(ids.rbegin(), ids.rend());
+        ids.erase(unique(ids.begin(), ids.end()), ids.end());
+        if(ids.size() > feedLimit){
+            ids.resize(feedLimit);
+            trimmedFeeds.insert(userId);
+        }
+        feeds[userId] = deque<int>(ids.begin(), ids.end());
+    }
 
 public:
+    Facebook(size_t celebrityThreshold = 1000, size_t feedLimit = 500, size_t cachedUsers = 100000)
+        : celebrityThreshold(celebrityThreshold), feedLimit(feedLimit), cache(cachedUsers){}
+
     void createPost(int userId, string content){
-        int postId = posts.size() + 1;
-        posts.push_front({postId, userId, content});
-        PostMap[postId] = posts.begin();
+        int postId = posts.create(userId, move(content));
+        userPosts[userId].push_back(postId);
+        invalidateAudience(userId);
+
+        pushToFeed(userId, postId);
+        if(!isCelebrity(userId)){
+            graph.forEachFollower(userId, [&](int fan){ pushToFeed(fan, postId); });
+        }
     }
 
+    // O(1): the post is tombstoned, and feed entries pointing at it are
+    // skipped when read until compact() drops them.
     void deletePost(int userId, int postId){
-        if(PostMap.find(postId) != PostMap.end() && PostMap[userId]->userId == userId){
-            posts.erase(PostMap[postId]);
-            PostMap.erase(postId);
+        const Post* post = posts.find(postId);
+        if(post && post->userId == userId){
+            posts.remove(postId);
+            invalidateAudience(userId);
+            if(posts.fragmented()) compact();
+        }
+    }
+
+    // Reclaims the memory of deleted posts, in the arena and in the post
+    // lists and feeds that still name them. Runs on its own once deleted
+    // posts outnumber live ones.
+    void compact(){
+        posts.compact();
+        // One oldest-first pass over the live posts rebuilds every author's
+        // list already sorted, and drops authors with nothing left.
+        unordered_map<int, vector<int>> live;
+        posts.forEach([&](const Post& post){ live[post.userId].push_back(post.id); });
+        userPosts.swap(live);
+        for(auto& [userId, feed]: feeds){
+            feed.erase(remove_if(feed.begin(), feed.end(), [&](int postId){ return !posts.find(postId); }), feed.end());
         }
     }
 
     void follow(int followerId, int followeeId){
-        if(followerId != followeeId){
-            followers[followerId].insert(followeeId);
+        if(followerId == followeeId) return;
+        bool wasCelebrity = isCelebrity(followeeId);
+        if(!graph.follow(followerId, followeeId)) return;
+        cache.invalidate(followerId);
+
+        if(isCelebrity(followeeId)){
+            // Crossing the threshold moves every fan over to read-time merging.
+            if(!wasCelebrity){
+                graph.forEachFollower(followeeId, [&](int fan){ celebritiesFollowed[fan].insert(followeeId); });
+            }
+            else celebritiesFollowed[followerId].insert(followeeId);
+            return;
         }
+
+        // Backfill the followee's recent posts.
+        vector<int> ids(feeds[followerId].begin(), feeds[followerId].end());
+        recentPosts(followeeId, feedLimit + 1, ids);
+        rebuildFeed(followerId, ids);
     }
 
     void unfollow(int followerId, int followeeId){
-        if(followerId != followeeId){
-            followers[followerId].erase(followeeId);
+        if(followerId == followeeId) return;
+        bool wasCelebrity = isCelebrity(followeeId);
+        if(!graph.unfollow(followerId, followeeId)) return;
+        cache.invalidate(followerId);
+        celebritiesFollowed[followerId].erase(followeeId);
+        if(wasCelebrity && !isCelebrity(followeeId)){
+            // Back to fan-out: fans need the posts that were merged at read time.
+            graph.forEachFollower(followeeId, [&](int fan){
+                celebritiesFollowed[fan].erase(followeeId);
+                vector<int> ids(feeds[fan].begin(), feeds[fan].end());
+                recentPosts(followeeId, feedLimit + 1, ids);
+                rebuildFeed(fan, ids);
+            });
         }
+
+        vector<int> ids;
+        for(int postId: feeds[followerId]){
+            const Post* post = posts.find(postId);
+            if(post && post->userId != followeeId) ids.push_back(postId);
+        }
+        rebuildFeed(followerId, ids);
     }
 
-    vector<Post> getNewsFrom(int userId){
-        vector<Post> feed;
-        for(auto post: posts){
-            if(post.userId == userId || followers[userId].count(post.userId)){
-                feed.push_back(post);
+    // Loads many (follower, followee) pairs at once, e.g. a graph export.
+    // The graph is rebuilt in one pass; afterwards celebrity status and
+    // the feeds of the importing followers are brought up to date.
+    void importFollows(vector<pair<int, int>> edges){
+        graph.bulkImport(edges);
+        unordered_set<int> followees, followersTouched;
+        for(auto [followerId, followeeId]: edges){
+            if(followerId == followeeId) continue;
+            followees.insert(followeeId);
+            followersTouched.insert(followerId);
+        }
+        for(int followee: followees){
+            if(isCelebrity(followee)){
+                graph.forEachFollower(followee, [&](int fan){ celebritiesFollowed[fan].insert(followee); });
             }
         }
-        return feed;
+        for(int followerId: followersTouched){
+            cache.invalidate(followerId);
+            vector<int> ids(feeds[followerId].begin(), feeds[followerId].end());
+            graph.forEachFollowee(followerId, [&](int followee){
+                if(!isCelebrity(followee)) recentPosts(followee, feedLimit + 1, ids);
+            });
+            rebuildFeed(followerId, ids);
+        }
+    }
+
+    // The newest limit posts of the user and everyone they follow. Costs
+    // O(limit) per source: the precomputed feed plus each celebrity
+    // followed, whatever the total number of posts. A feed that has dropped
+    // old ids cannot answer for more than it holds, so when deletes or a
+    // limit above feedLimit leave it short, the page comes from
+    // getTimeline, which reaches back over the full history.
+    vector<Post> getNewsFrom(int userId, size_t limit = 20){
+        return *getNewsPage(userId, limit);
+    }
+
+    // getNewsFrom without the copy: repeated reads of an unchanged feed
+    // share one cached page.
+    FeedCache::Page getNewsPage(int userId, size_t limit = 20){
+        FeedCache::Page cached = cache.get(userId, limit);
+        if(cached) return cached;
+
+        vector<int> ids;
+        size_t taken = 0;
+        auto feed = feeds.find(userId);
+        if(feed != feeds.end()){
+            for(int postId: feed->second){
+                if(taken == limit) break;
+                if(posts.find(postId)){
+                    ids.push_back(postId);
+                    taken++;
+                }
+            }
+        }
+        if(taken < limit && trimmedFeeds.count(userId)){
+            auto page = make_shared<vector<Post>>(getTimeline(userId, limit).posts);
+            cache.put(userId, limit, page);
+            return page;
+        }
+        auto celebrities = celebritiesFollowed.find(userId);
+        if(celebrities != celebritiesFollowed.end()){
+            for(int celebrity: celebrities->second) recentPosts(celebrity, limit, ids);
+        }
+
+        sort(ids.rbegin(), ids.rend());
+        ids.erase(unique(ids.begin(), ids.end()), ids.end());
+        if(ids.size() > limit) ids.resize(limit);
+
+        auto page = make_shared<vector<Post>>();
+        for(int postId: ids) page->push_back(*posts.find(postId));
+        cache.put(userId, limit, page);
+        return page;
+    }
+
+    CacheStats cacheStats(){
+        return cache.stats();
+    }
+
+    // Batch feeds for a digest job: for each of userIds, the newest
+    // perUser posts newer than sinceId from them and whoever they follow,
+    // in the same order as userIds. Instead of one read per user, authors
+    // are split across threads and each routes its candidate posts, at
+    // most perUser of them, to those of its followers being digested.
+    // Deliveries are bucketed by the thread that owns the recipient, which
+    // then ranks them, so the job costs O(posts + perUser * edges) spread
+    // over the threads. Nothing may modify the object meanwhile.
+    vector<vector<Post>> buildDigests(const vector<int>& userIds, size_t perUser = 20, int sinceId = 0,
+                                      unsigned threads = thread::hardware_concurrency()){
+        threads = max(1u, threads);
+        unordered_map<int, size_t> slotOf;
+        for(int userId: userIds) slotOf.emplace(userId, slotOf.size());
+        vector<int> authors;
+        for(auto& [author, ids]: userPosts) authors.push_back(author);
+
+        // routed[producer][owner] holds (recipient slot, post id) pairs.
+        vector<vector<vector<pair<size_t, int>>>> routed(threads, vector<vector<pair<size_t, int>>>(threads));
+        vector<thread> workers;
+        for(unsigned t = 0; t < threads; t++){
+            workers.emplace_back([&, t]{
+                vector<int> candidates;
+                for(size_t a = t; a < authors.size(); a += threads){
+                    const vector<int>& ids = userPosts.find(authors[a])->second;
+                    candidates.clear();
+                    for(auto post = ids.rbegin(); post != ids.rend() && *post > sinceId && candidates.size() < perUser; post++){
+                        if(posts.find(*post)) candidates.push_back(*post);
+                    }
+                    if(candidates.empty()) continue;
+                    auto deliver = [&](int userId){
+                        auto slot = slotOf.find(userId);
+                        if(slot == slotOf.end()) return;
+                        for(int postId: candidates) routed[t][slot->second % threads].push_back({slot->second, postId});
+                    };
+                    deliver(authors[a]);
+                    graph.forEachFollower(authors[a], deliver);
+                }
+            });
+        }
+        for(auto& worker: workers) worker.join();
+        workers.clear();
+
+        vector<vector<Post>> digests(slotOf.size());
+        for(unsigned t = 0; t < threads; t++){
+            workers.emplace_back([&, t]{
+                vector<vector<int>> inbox(slotOf.size() / threads + 1);
+                for(unsigned producer = 0; producer < threads; producer++){
+                    for(auto [slot, postId]: routed[producer][t]) inbox[slot / threads].push_back(postId);
+                }
+                for(size_t i = 0; i < inbox.size(); i++){
+                    vector<int>& ids = inbox[i];
+                    size_t keep = min(perUser, ids.size());
+                    partial_sort(ids.begin(), ids.begin() + keep, ids.end(), greater<int>());
+                    for(size_t k = 0; k < keep; k++) digests[i * threads + t].push_back(*posts.find(ids[k]));
+                }
+            });
+        }
+        for(auto& worker: workers) worker.join();
+
+        vector<vector<Post>> result;
+        for(int userId: userIds) result.push_back(digests[slotOf[userId]]);
+        return result;
+    }
+
+    // Pull-model alternative to getNewsFrom: a k-way merge over the post
+    // lists of the user and everyone they follow, newest first, starting
+    // below cursor (a post id). A heap holds the next post of each source,
+    // so a page costs O(limit log k) plus a binary search per source to
+    // resume, and reaches back over the full history rather than the
+    // newest feedLimit posts.
+    FeedPage getTimeline(int userId, size_t limit = 20, int cursor = INT_MAX){
+        // (post id, author, index into the author's post list)
+        priority_queue<tuple<int, int, size_t>> heap;
+        auto addSource = [&](int author){
+            auto it = userPosts.find(author);
+            if(it == userPosts.end()) return;
+            size_t next = lower_bound(it->second.begin(), it->second.end(), cursor) - it->second.begin();
+            if(next > 0) heap.push({it->second[next - 1], author, next - 1});
+        };
+        addSource(userId);
+        graph.forEachFollowee(userId, addSource);
+
+        FeedPage page{{}, 0};
+        while(!heap.empty() && page.posts.size() < limit){
+            auto [postId, author, index] = heap.top();
+            heap.pop();
+            if(index > 0) heap.push({userPosts[author][index - 1], author, index - 1});
+            const Post* post = posts.find(postId);
+            if(post) page.posts.push_back(*post);
+        }
+        if(!heap.empty() && !page.posts.empty()) page.nextCursor = page.posts.back().id;
+        return page;
     }
 };
 
@@ -74,5 +723,14 @@ int main(){
     for(auto post: feed) cout<< "User " << post.userId << " post "<<endl << " content: "<< post.content<<endl;
     cout<<"--------------------------"<<endl;
     for(auto post: feed1) cout<< "User " << post.userId << " post "<<endl<<" content: "<< post.content<<endl;
+    cout<<"--------------------------"<<endl;
+    for(FeedPage page = fb.getTimeline(A, 4); ; page = fb.getTimeline(A, 4, page.nextCursor)){
+        for(auto post: page.posts) cout<< "User " << post.userId << " post " << post.id <<endl;
+        if(page.nextCursor == 0) break;
+        cout<<"next page"<<endl;
+    }
+    cout<<"--------------------------"<<endl;
+    vector<vector<Post>> digests = fb.buildDigests({A, B, C, D}, 3);
+    for(int user: {A, B, C, D}) cout<< "Digest for user " << user << ": " << digests[user - 1].size() << " posts" <<endl;
     return 0;
 }
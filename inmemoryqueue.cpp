@@ -1,36 +1,1610 @@
 #include <iostream>
 #include <unordered_map>
 #include <vector>
-#include <queue>
+#include <deque>
 #include <memory>
+#include <string_view>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 using namespace std;
 
-class MessageQueue {
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+// What publish does when a topic's ring is full.
+enum class BackpressurePolicy {
+    BLOCK,        // wait (helping to drain) until a slot frees up
+    DROP_OLDEST,  // evict the oldest queued message to make room
+    FAIL          // reject the message, publish returns false
+};
+
+// Bounded multi-producer/multi-consumer ring (Vyukov). Every slot carries a
+// sequence number so producers and consumers only contend on head/tail.
+template <typename T>
+class RingBuffer {
+private:
+    struct Slot {
+        atomic<size_t> sequence;
+        T value;
+    };
+
+    unique_ptr<Slot[]> slots;
+    size_t mask;
+    alignas(CACHE_LINE_SIZE) atomic<size_t> head{0};
+    alignas(CACHE_LINE_SIZE) atomic<size_t> tail{0};
+
+    static size_t roundUpToPowerOfTwo(size_t n) {
+        size_t capacity = 2;
+        while (capacity < n) capacity <<= 1;
+        return capacity;
+    }
+
+public:
+    explicit RingBuffer(size_t requestedCapacity) {
+        size_t capacity = roundUpToPowerOfTwo(requestedCapacity);
+        slots.reset(new Slot[capacity]);
+        mask = capacity - 1;
+        for (size_t i = 0; i < capacity; i++) {
+            slots[i].sequence.store(i, memory_order_relaxed);
+        }
+    }
+
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    // value is only moved from when the push succeeds.
+    bool tryPush(T&& value) {
+        size_t pos = head.load(memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots[pos & mask];
+            size_t seq = slot->sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = head.load(memory_order_relaxed);
+            }
+        }
+        slot->value = std::move(value);
+        slot->sequence.store(pos + 1, memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T& out) {
+        size_t pos = tail.load(memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots[pos & mask];
+            size_t seq = slot->sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail.load(memory_order_relaxed);
+            }
+        }
+        out = std::move(slot->value);
+        slot->sequence.store(pos + mask + 1, memory_order_release);
+        return true;
+    }
+
+    // Claims up to maxItems consecutive ready slots with a single CAS on
+    // tail, so a consumer pays one contended operation per batch.
+    size_t tryPopBatch(T* out, size_t maxItems) {
+        size_t pos = tail.load(memory_order_relaxed);
+        size_t count;
+        while (true) {
+            count = 0;
+            while (count < maxItems &&
+                   slots[(pos + count) & mask].sequence.load(memory_order_acquire) == pos + count + 1) {
+                count++;
+            }
+            if (count == 0) {
+                size_t current = tail.load(memory_order_relaxed);
+                if (current == pos) return 0;
+                pos = current;
+                continue;
+            }
+            if (tail.compare_exchange_weak(pos, pos + count, memory_order_relaxed)) break;
+        }
+        for (size_t i = 0; i < count; i++) {
+            Slot& slot = slots[(pos + i) & mask];
+            out[i] = std::move(slot.value);
+            slot.sequence.store(pos + i + mask + 1, memory_order_release);
+        }
+        return count;
+    }
+
+    size_t size() const {
+        size_t h = head.load(memory_order_acquire);
+        size_t t = tail.load(memory_order_acquire);
+        return h > t ? h - t : 0;
+    }
+
+    size_t capacity() const { return mask + 1; }
+};
+
+// Hierarchical timing wheel: LEVELS wheels of SLOTS buckets, each level
+// covering SLOTS times the span of the one below (1 tick, 256 ticks, 64K
+// ticks, 16M ticks). Insert and expiry are O(1); a timer only moves down a
+// level when its bucket comes round, instead of living in a heap.
+template <typename T>
+class TimingWheel {
+private:
+    static constexpr int LEVELS = 4;
+    static constexpr int SLOT_BITS = 8;
+    static constexpr uint64_t SLOTS = 1 << SLOT_BITS;
+
+    struct Timer {
+        uint64_t deadline;
+        T value;
+    };
+
+    vector<Timer> wheels[LEVELS][SLOTS];
+    uint64_t currentTick = 0;
+    size_t count = 0;
+
+    void place(Timer timer) {
+        uint64_t delta = timer.deadline - currentTick;
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= (uint64_t)1 << (SLOT_BITS * (level + 1))) level++;
+        uint64_t slot = (timer.deadline >> (SLOT_BITS * level)) & (SLOTS - 1);
+        wheels[level][slot].push_back(std::move(timer));
+    }
+
+    void cascade(int level) {
+        uint64_t slot = (currentTick >> (SLOT_BITS * level)) & (SLOTS - 1);
+        vector<Timer> timers;
+        timers.swap(wheels[level][slot]);
+        for (auto& timer : timers) {
+            place(std::move(timer));
+        }
+    }
+
+public:
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    // Timers due at or before the current tick fire on the next advance.
+    void insert(uint64_t deadline, T value) {
+        count++;
+        place({max(deadline, currentTick + 1), std::move(value)});
+    }
+
+    // Earliest pending deadline. Within a level, buckets in rotation order
+    // after the current one hold later and later deadlines, so only the
+    // first occupied bucket of each level needs looking at.
+    uint64_t nextDeadline() const {
+        uint64_t next = UINT64_MAX;
+        for (int level = 0; level < LEVELS; level++) {
+            uint64_t position = currentTick >> (SLOT_BITS * level);
+            for (uint64_t i = 1; i <= SLOTS; i++) {
+                const vector<Timer>& bucket = wheels[level][(position + i) & (SLOTS - 1)];
+                if (bucket.empty()) continue;
+                for (const auto& timer : bucket) {
+                    next = min(next, timer.deadline);
+                }
+                break;
+            }
+        }
+        return next;
+    }
+
+    // Jumps straight to tick; only valid while no timers are pending.
+    void reset(uint64_t tick) {
+        if (count == 0) currentTick = tick;
+    }
+
+    // Moves time forward to tick, handing every timer that expires on the
+    // way to fire(T&) in deadline order.
+    template <typename Fire>
+    void advance(uint64_t tick, Fire fire) {
+        while (currentTick < tick && count > 0) {
+            currentTick++;
+            for (int level = 1; level < LEVELS; level++) {
+                if ((currentTick & (((uint64_t)1 << (SLOT_BITS * level)) - 1)) != 0) break;
+                cascade(level);
+            }
+            vector<Timer>& due = wheels[0][currentTick & (SLOTS - 1)];
+            for (auto& timer : due) {
+                fire(timer.value);
+            }
+            count -= due.size();
+            due.clear();
+        }
+        if (count == 0 && currentTick < tick) currentTick = tick;
+    }
+};
+
+typedef uint32_t TopicId;
+
+// A published message. The payload is allocated once and shared by every
+// ring, mailbox and subscriber it fans out to; only the refcount is copied.
+struct Message {
+    shared_ptr<const string> payload;
+    TopicId topic;
+    uint64_t offset = 0;
+    uint32_t partition = 0;
+    int64_t expiresAt = 0;    // steady_clock nanoseconds, 0 = never
+    uint32_t attempt = 0;     // redeliveries so far
+    int64_t publishedAt = 0;  // steady_clock nanoseconds
+};
+
+inline int64_t steadyNanos() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline bool isExpired(const Message& message, int64_t now) {
+    return message.expiresAt != 0 && message.expiresAt <= now;
+}
+
+// Read-only mapping of a segment file prefix.
+class MappedFile {
+private:
+    void* data = MAP_FAILED;
+    size_t length = 0;
+
+public:
+    MappedFile(const string& path, size_t length) : length(length) {
+        if (length == 0) return;
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        data = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data != MAP_FAILED) madvise(data, length, MADV_SEQUENTIAL);
+    }
+
+    ~MappedFile() {
+        if (data != MAP_FAILED) munmap(data, length);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool valid() const { return length == 0 || data != MAP_FAILED; }
+    const char* begin() const { return (const char*)data; }
+    size_t size() const { return data == MAP_FAILED ? 0 : length; }
+};
+
+// Append-only log for one topic, split into size-rolled segment files named
+// after their base offset. A record is [uint32 length][payload]; every
+// segment also has a sparse .index of (relative offset, file position)
+// pairs written every INDEX_INTERVAL bytes, so a read or a cold-start
+// recovery only walks records from the nearest index entry.
+class SegmentLog {
+private:
+    static constexpr size_t INDEX_INTERVAL = 4096;
+
+    struct IndexEntry {
+        uint32_t relativeOffset;
+        uint32_t position;
+    };
+
+    struct Segment {
+        uint64_t baseOffset = 0;
+        uint64_t records = 0;
+        size_t bytes = 0;
+        vector<IndexEntry> index;
+    };
+
+    string directory;
+    size_t segmentBytes;
+    vector<Segment> segments;  // guarded by mtx, last one is active
+    int logFd = -1;
+    int indexFd = -1;
+    size_t bytesSinceIndex = 0;
+    mutex mtx;
+
+    string segmentPath(uint64_t baseOffset, const char* extension) const {
+        char name[32];
+        snprintf(name, sizeof(name), "%020llu.%s", (unsigned long long)baseOffset, extension);
+        return directory + "/" + name;
+    }
+
+    static bool writeAll(int fd, const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0) return false;
+            data += written;
+            size -= written;
+        }
+        return true;
+    }
+
+    bool openActive() {
+        Segment& active = segments.back();
+        logFd = ::open(segmentPath(active.baseOffset, "log").c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        indexFd = ::open(segmentPath(active.baseOffset, "index").c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        bytesSinceIndex = active.index.empty() ? active.bytes : active.bytes - active.index.back().position;
+        return logFd >= 0 && indexFd >= 0;
+    }
+
+    void closeActive() {
+        if (logFd >= 0) ::close(logFd);
+        if (indexFd >= 0) ::close(indexFd);
+        logFd = indexFd = -1;
+    }
+
+    // Rebuilds record count and size of the last segment by walking only the
+    // records after its last index entry, dropping a torn trailing write.
+    void recoverTail(Segment& segment) {
+        string logPath = segmentPath(segment.baseOffset, "log");
+        struct stat st;
+        size_t fileSize = ::stat(logPath.c_str(), &st) == 0 ? st.st_size : 0;
+        while (!segment.index.empty() && segment.index.back().position >= fileSize) {
+            segment.index.pop_back();
+        }
+
+        size_t pos = segment.index.empty() ? 0 : segment.index.back().position;
+        uint64_t records = segment.index.empty() ? 0 : segment.index.back().relativeOffset;
+        MappedFile file(logPath, fileSize);
+        while (pos + sizeof(uint32_t) <= file.size()) {
+            uint32_t length;
+            memcpy(&length, file.begin() + pos, sizeof(length));
+            if (pos + sizeof(length) + length > file.size()) break;
+            pos += sizeof(length) + length;
+            records++;
+        }
+        if (pos != fileSize && ::truncate(logPath.c_str(), pos) != 0) {
+            cerr << "SegmentLog: failed to truncate " << logPath << endl;
+        }
+        segment.records = records;
+        segment.bytes = pos;
+
+        string indexPath = segmentPath(segment.baseOffset, "index");
+        if (filesystem::exists(indexPath) && ::truncate(indexPath.c_str(), segment.index.size() * sizeof(IndexEntry)) != 0) {
+            cerr << "SegmentLog: failed to truncate " << indexPath << endl;
+        }
+    }
+
+    bool roll() {
+        closeActive();
+        Segment next;
+        next.baseOffset = segments.back().baseOffset + segments.back().records;
+        segments.push_back(next);
+        return openActive();
+    }
+
+public:
+    SegmentLog(const string& directory, size_t segmentBytes) : directory(directory), segmentBytes(segmentBytes) {}
+
+    ~SegmentLog() {
+        closeActive();
+    }
+
+    SegmentLog(const SegmentLog&) = delete;
+    SegmentLog& operator=(const SegmentLog&) = delete;
+
+    bool open() {
+        lock_guard<mutex> lock(mtx);
+        error_code ec;
+        filesystem::create_directories(directory, ec);
+        if (ec) return false;
+
+        for (const auto& entry : filesystem::directory_iterator(directory, ec)) {
+            if (entry.path().extension() != ".log") continue;
+            Segment segment;
+            segment.baseOffset = stoull(entry.path().stem().string());
+            segment.bytes = entry.file_size();
+            segments.push_back(segment);
+        }
+        sort(segments.begin(), segments.end(), [](const Segment& a, const Segment& b) {
+            return a.baseOffset < b.baseOffset;
+        });
+        if (segments.empty()) segments.push_back(Segment());
+
+        for (size_t i = 0; i < segments.size(); i++) {
+            Segment& segment = segments[i];
+            string indexPath = segmentPath(segment.baseOffset, "index");
+            MappedFile indexFile(indexPath, filesystem::exists(indexPath) ? filesystem::file_size(indexPath) : 0);
+            segment.index.resize(indexFile.size() / sizeof(IndexEntry));
+            if (!segment.index.empty()) memcpy(segment.index.data(), indexFile.begin(), segment.index.size() * sizeof(IndexEntry));
+            if (i + 1 < segments.size()) segment.records = segments[i + 1].baseOffset - segment.baseOffset;
+        }
+        recoverTail(segments.back());
+        return openActive();
+    }
+
+    // Appends the batch as one write, assigning consecutive offsets.
+    bool append(Message* messages, size_t count) {
+        lock_guard<mutex> lock(mtx);
+        string buffer;
+        vector<IndexEntry> newIndex;
+
+        auto flush = [&]() {
+            bool ok = writeAll(logFd, buffer.data(), buffer.size()) &&
+                      writeAll(indexFd, (const char*)newIndex.data(), newIndex.size() * sizeof(IndexEntry));
+            buffer.clear();
+            newIndex.clear();
+            return ok;
+        };
+
+        for (size_t i = 0; i < count; i++) {
+            const string& payload = *messages[i].payload;
+            uint32_t length = (uint32_t)payload.size();
+            size_t recordSize = sizeof(length) + length;
+
+            if (segments.back().bytes > 0 && segments.back().bytes + recordSize > segmentBytes) {
+                if (!flush() || !roll()) return false;
+            }
+            Segment& active = segments.back();
+            if (active.bytes == 0 || bytesSinceIndex >= INDEX_INTERVAL) {
+                IndexEntry entry{(uint32_t)active.records, (uint32_t)active.bytes};
+                active.index.push_back(entry);
+                newIndex.push_back(entry);
+                bytesSinceIndex = 0;
+            }
+            buffer.append((const char*)&length, sizeof(length));
+            buffer.append(payload);
+            messages[i].offset = active.baseOffset + active.records;
+            active.records++;
+            active.bytes += recordSize;
+            bytesSinceIndex += recordSize;
+        }
+        return flush();
+    }
+
+    uint64_t endOffset() {
+        lock_guard<mutex> lock(mtx);
+        return segments.back().baseOffset + segments.back().records;
+    }
+
+    bool sync() {
+        lock_guard<mutex> lock(mtx);
+        return ::fsync(logFd) == 0 && ::fsync(indexFd) == 0;
+    }
+
+    // Calls visit(offset, payload) for up to maxMessages records starting at
+    // fromOffset. Payload views point straight into the mapped segment and
+    // are only valid during the call. Returns the next offset to read.
+    template <typename Visitor>
+    uint64_t read(uint64_t fromOffset, size_t maxMessages, Visitor visit) {
+        vector<Segment> snapshot;
+        {
+            lock_guard<mutex> lock(mtx);
+            for (const auto& segment : segments) {
+                if (segment.baseOffset + segment.records > fromOffset) snapshot.push_back(segment);
+            }
+        }
+
+        uint64_t offset = fromOffset;
+        for (const auto& segment : snapshot) {
+            if (maxMessages == 0) break;
+            MappedFile file(segmentPath(segment.baseOffset, "log"), segment.bytes);
+            if (!file.valid()) break;
+
+            uint64_t target = max(offset, segment.baseOffset);
+            auto it = upper_bound(segment.index.begin(), segment.index.end(), target - segment.baseOffset,
+                                  [](uint64_t relative, const IndexEntry& entry) { return relative < entry.relativeOffset; });
+            size_t pos = 0;
+            uint64_t current = segment.baseOffset;
+            if (it != segment.index.begin()) {
+                --it;
+                pos = it->position;
+                current += it->relativeOffset;
+            }
+
+            const char* data = file.begin();
+            while (pos + sizeof(uint32_t) <= file.size() && maxMessages > 0) {
+                uint32_t length;
+                memcpy(&length, data + pos, sizeof(length));
+                if (current >= target) {
+                    visit(current, string_view(data + pos + sizeof(length), length));
+                    maxMessages--;
+                    offset = current + 1;
+                }
+                pos += sizeof(length) + length;
+                current++;
+            }
+        }
+        return offset;
+    }
+};
+
+enum class Ack { ACK, NACK };
+
+// What a handler is given for each message. The views are only valid for
+// the duration of the call.
+struct Delivery {
+    string_view payload;
+    string_view topic;
+    uint64_t offset;
+    uint32_t partition;
+    uint32_t attempt;
+    int64_t publishedAt;
+};
+
+// How a subscription retries a message its handler NACKed or threw on.
+// Retries are scheduled on the timer wheel, so a failing message never holds
+// up the messages behind it; once maxRetries is spent it goes to
+// "<topic>.dlq".
+struct RetryPolicy {
+    uint32_t maxRetries = 3;
+    chrono::milliseconds initialBackoff{100};
+    double multiplier = 2.0;
+    chrono::milliseconds maxBackoff{10000};
+
+    chrono::milliseconds backoff(uint32_t attempt) const {
+        double delay = initialBackoff.count();
+        for (uint32_t i = 0; i < attempt && delay < maxBackoff.count(); i++) delay *= multiplier;
+        return chrono::milliseconds(min((int64_t)delay, (int64_t)maxBackoff.count()));
+    }
+};
+
+// Move-only, type-erased handler that keeps its callable (and whatever
+// consumer state it captures) in inline storage, so a subscription never
+// heap-allocates and a delivery is one indirect call. Callables may return
+// Ack or void (treated as ACK).
+class MessageHandler {
 private:
-    unordered_map<string, queue<string>> topics;
-    unordered_map<string, vector<void(*)(string, string)>> subscribers;
+    static constexpr size_t INLINE_SIZE = 48;
+
+    alignas(max_align_t) unsigned char storage[INLINE_SIZE];
+    Ack (*invoke)(void*, const Delivery&) = nullptr;
+    void (*relocate)(void* from, void* to) = nullptr;
+    void (*destroy)(void*) = nullptr;
+
+    template <typename Fn>
+    static Ack call(void* fn, const Delivery& delivery) {
+        if constexpr (is_void<invoke_result_t<Fn&, const Delivery&>>::value) {
+            (*(Fn*)fn)(delivery);
+            return Ack::ACK;
+        } else {
+            return (*(Fn*)fn)(delivery);
+        }
+    }
+
+    void reset() {
+        if (destroy) destroy(storage);
+        invoke = nullptr;
+        relocate = nullptr;
+        destroy = nullptr;
+    }
+
+    void moveFrom(MessageHandler& other) {
+        if (!other.invoke) return;
+        other.relocate(other.storage, storage);
+        invoke = other.invoke;
+        relocate = other.relocate;
+        destroy = other.destroy;
+        other.invoke = nullptr;
+        other.relocate = nullptr;
+        other.destroy = nullptr;
+    }
 
 public:
-    void publish(const string& topic, const string& message) {
-        topics[topic].push(message);
+    MessageHandler() = default;
+
+    template <typename F, typename Fn = decay_t<F>,
+              typename = enable_if_t<!is_same<Fn, MessageHandler>::value && is_invocable<Fn&, const Delivery&>::value>>
+    MessageHandler(F&& f) {
+        static_assert(sizeof(Fn) <= INLINE_SIZE, "handler state does not fit in MessageHandler inline storage");
+        static_assert(alignof(Fn) <= alignof(max_align_t), "handler is over-aligned");
+        static_assert(is_nothrow_move_constructible<Fn>::value, "handler must be nothrow movable");
+        new (storage) Fn(std::forward<F>(f));
+        invoke = &call<Fn>;
+        relocate = [](void* from, void* to) {
+            new (to) Fn(std::move(*(Fn*)from));
+            ((Fn*)from)->~Fn();
+        };
+        destroy = [](void* fn) { ((Fn*)fn)->~Fn(); };
+    }
+
+    MessageHandler(MessageHandler&& other) noexcept { moveFrom(other); }
+
+    MessageHandler& operator=(MessageHandler&& other) noexcept {
+        if (this != &other) {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    ~MessageHandler() { reset(); }
+
+    explicit operator bool() const { return invoke != nullptr; }
+
+    Ack operator()(const Delivery& delivery) { return invoke(storage, delivery); }
+};
+
+// INLINE runs subscriber callbacks on the publishing thread. ASYNC gives
+// every subscription its own mailbox that a worker pool drains, so publish
+// latency does not depend on how slow consumers are.
+enum class DispatchMode { INLINE, ASYNC };
+
+struct SubscriberLag {
+    size_t subscriptionId;
+    string topic;
+    uint64_t enqueued;
+    uint64_t delivered;
+    uint64_t evicted;   // accepted, then pushed out by DROP_OLDEST
+    uint64_t rejected;  // never accepted (FAIL, or BLOCK given up)
+    uint64_t nacked;
+    uint64_t expired;
+    uint64_t retried;
+    uint64_t deadLettered;
+    uint64_t lag;
+};
+
+class MessageQueue {
+private:
+    static constexpr size_t DELIVERY_BATCH = 64;
+
+    struct Topic;
+
+    // Owned by the subscriptions map while subscribed; pending retries and
+    // in-flight polls hold their own reference, so the mailbox is freed once
+    // the last of them lets go after unsubscribe.
+    struct Subscription : enable_shared_from_this<Subscription> {
+        size_t id;
+        Topic* topic;
+        MessageHandler handler;                   // empty for pull subscriptions
+        RetryPolicy retry;
+        unique_ptr<RingBuffer<Message>> mailbox;  // ASYNC or pull only
+        size_t worker;
+        atomic<bool> active{true};
+        shared_mutex handlerMutex;  // held shared by deliveries made off the subscriber list
+        atomic<uint64_t> enqueued{0};
+        atomic<uint64_t> delivered{0};
+        atomic<uint64_t> evicted{0};
+        atomic<uint64_t> rejected{0};
+        atomic<uint64_t> nacked{0};
+        atomic<uint64_t> expired{0};
+        atomic<uint64_t> retried{0};
+        atomic<uint64_t> deadLettered{0};
+    };
+
+    struct ConsumerGroup;
+
+    struct Topic {
+        TopicId id;
+        string name;
+        uint32_t partitions;
+        RingBuffer<Message> ring;
+        shared_mutex subscribersMutex;
+        vector<Subscription*> subscribers;
+        vector<ConsumerGroup*> groups;  // guarded by subscribersMutex
+        atomic<size_t> groupCount{0};
+        atomic<size_t> mailboxCount{0};  // subscribers with a mailbox, guarded by subscribersMutex
+        atomic<uint64_t> dropped{0};
+        atomic<uint64_t> nextOffset{0};
+        atomic<uint32_t> nextPartition{0};
+        unique_ptr<SegmentLog> log;  // set when persistence is enabled
+        bool durable = false;        // persistence is enabled, so publishes need the log
+
+        Topic(TopicId id, const string& name, uint32_t partitions, size_t capacity)
+            : id(id), name(name), partitions(partitions), ring(capacity) {}
+    };
+
+    // The group keeps one mailbox per partition of its topic, and each
+    // partition is owned by exactly one member at a time. Members only touch
+    // their own partitions, so consumption of a hot topic scales with them.
+    struct ConsumerGroup {
+        string name;
+        Topic* topic;
+        vector<unique_ptr<RingBuffer<Message>>> partitions;
+        atomic<uint64_t> dropped{0};
+        atomic<bool> routing{false};  // has members and is not deleted
+        shared_mutex membershipMutex;
+        vector<string> members;  // sorted, guarded by membershipMutex
+        unordered_map<string, vector<uint32_t>> assignment;
+        bool deleted = false;  // guarded by membershipMutex
+    };
+
+    struct Worker {
+        thread runner;
+        mutex mtx;
+        condition_variable cv;
+        atomic<bool> pending{false};
+        bool stopping = false;
+        vector<shared_ptr<Subscription>> subscriptions;  // guarded by mtx
+        uint64_t version = 0;                 // bumped whenever subscriptions changes
+    };
+
+    // Topics are interned to dense ids and only ever added, so publishers
+    // just take a shared lock to find theirs; the ring itself is lock-free.
+    vector<unique_ptr<Topic>> topics;
+    unordered_map<string, TopicId> topicIds;
+    shared_mutex topicsMutex;
+    unordered_map<size_t, shared_ptr<Subscription>> subscriptions;
+    size_t nextSubscriptionId = 0;  // guarded by subscriptionsMutex
+    mutex subscriptionsMutex;
+    vector<unique_ptr<Worker>> workers;
+    unordered_map<string, shared_ptr<ConsumerGroup>> groups;
+    mutex groupsMutex;
+    size_t ringCapacity;
+    BackpressurePolicy policy;
+    DispatchMode mode;
+    string persistenceDirectory;
+    size_t segmentBytes = 0;
+
+    // A delayed message is published to its topic when due; a retry (target
+    // set) is redelivered to that one subscription only.
+    struct ScheduledMessage {
+        Message message;
+        shared_ptr<Subscription> target;
+    };
+
+    // Delayed messages and retries wait in the wheel (1 ms ticks since
+    // construction) until a single timer thread fires them.
+    static constexpr chrono::milliseconds TIMER_TICK{1};
+    TimingWheel<ScheduledMessage> timers;
+    mutex timerMutex;
+    condition_variable timerCv;
+    thread timerThread;
+    bool timersStopping = false;
+    chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+
+    // Due delayed publishes and INLINE retries can run handlers or wait on
+    // a full mailbox, so the timer thread hands them to a small pool of
+    // their own rather than run them itself; one slow subscriber then holds
+    // up no other timer. Started with the first hand-off.
+    vector<thread> dueThreads;
+    size_t dueThreadCount = 1;
+    deque<ScheduledMessage> dueQueue;
+    mutex dueMutex;
+    condition_variable dueCv;
+    bool dueStopping = false;
+
+    // Caller holds topicsMutex exclusively. A durable topic whose log fails
+    // to open refuses publishes until persistence is enabled again.
+    bool attachLog(Topic& topic) {
+        topic.durable = true;
+        auto log = make_unique<SegmentLog>(persistenceDirectory + "/" + topic.name, segmentBytes);
+        if (!log->open()) {
+            cerr << "Failed to open log for topic " << topic.name << endl;
+            return false;
+        }
+        topic.log = std::move(log);
+        return true;
+    }
+
+    // Caller holds topicsMutex exclusively.
+    Topic& addTopic(const string& name, uint32_t partitions = 1) {
+        TopicId id = (TopicId)topics.size();
+        topics.push_back(make_unique<Topic>(id, name, partitions, ringCapacity));
+        topicIds[name] = id;
+        if (!persistenceDirectory.empty()) attachLog(*topics.back());
+        return *topics.back();
+    }
+
+    Topic& getTopic(const string& name) {
+        {
+            shared_lock<shared_mutex> lock(topicsMutex);
+            auto it = topicIds.find(name);
+            if (it != topicIds.end()) return *topics[it->second];
+        }
+        unique_lock<shared_mutex> lock(topicsMutex);
+        auto it = topicIds.find(name);
+        if (it != topicIds.end()) return *topics[it->second];
+        return addTopic(name);
+    }
+
+    Topic& getTopic(TopicId id) {
+        shared_lock<shared_mutex> lock(topicsMutex);
+        return *topics.at(id);
+    }
+
+    // waitForSpace runs between retries under BLOCK; returning false gives
+    // up. Returns false when the message was rejected, which the caller
+    // counts; messages evicted to make room are counted in evicted.
+    template <typename WaitForSpace>
+    bool enqueue(RingBuffer<Message>& ring, Message message, atomic<uint64_t>& evicted, WaitForSpace waitForSpace) {
+        switch (policy) {
+        case BackpressurePolicy::BLOCK:
+            while (!ring.tryPush(std::move(message))) {
+                if (!waitForSpace()) return false;
+            }
+            return true;
+        case BackpressurePolicy::DROP_OLDEST:
+            while (!ring.tryPush(std::move(message))) {
+                Message oldest;
+                if (ring.tryPop(oldest)) evicted++;
+            }
+            return true;
+        case BackpressurePolicy::FAIL:
+            return ring.tryPush(std::move(message));
+        }
+        return false;
+    }
+
+    // Hands a batch to one subscription's mailbox; returns how many were
+    // accepted under the backpressure policy.
+    size_t enqueueToMailbox(Subscription& subscription, const Message* messages, size_t count) {
+        size_t accepted = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (enqueue(*subscription.mailbox, messages[i], subscription.evicted, [&] {
+                    // The wake for this batch only goes out once all of it
+                    // is queued, so make sure the worker is draining now.
+                    if (subscription.handler && mode == DispatchMode::ASYNC) {
+                        wakeWorker(*workers[subscription.worker]);
+                    }
+                    this_thread::yield();
+                    return subscription.active.load();
+                })) {
+                accepted++;
+            }
+        }
+        subscription.enqueued += accepted;
+        subscription.rejected += count - accepted;
+        return accepted;
+    }
+
+    void deliverMessages(Topic& topic) {
+        Message batch[DELIVERY_BATCH];
+        size_t count;
+        while ((count = topic.ring.tryPopBatch(batch, DELIVERY_BATCH)) > 0) {
+            shared_lock<shared_mutex> lock(topic.subscribersMutex);
+            for (auto* subscription : topic.subscribers) {
+                if (!subscription->handler) continue;  // filled by dispatchToMailboxes
+                subscription->enqueued += count;
+                for (size_t i = 0; i < count; i++) {
+                    handle(*subscription, batch[i]);
+                }
+                subscription->delivered += count;
+            }
+        }
+    }
+
+    // Every subscriber with a mailbox (all of them in ASYNC mode, pull ones
+    // in INLINE mode) gets all count messages, at the cost of one
+    // subscriber-list lock and at most one worker wake-up per batch. Returns
+    // the fewest any of them accepted.
+    size_t dispatchToMailboxes(Topic& topic, const Message* messages, size_t count) {
+        size_t accepted = count;
+        shared_lock<shared_mutex> lock(topic.subscribersMutex);
+        for (auto* subscription : topic.subscribers) {
+            if (!subscription->mailbox) continue;
+            size_t queued = enqueueToMailbox(*subscription, messages, count);
+            accepted = min(accepted, queued);
+            if (queued > 0 && subscription->handler) wakeWorker(*workers[subscription->worker]);
+        }
+        return accepted;
+    }
+
+    size_t publishToTopic(Topic& topic, Message* messages, size_t count) {
+        if (topic.log) {
+            if (!topic.log->append(messages, count)) {
+                cerr << "Failed to append to log for topic " << topic.name << endl;
+                return 0;
+            }
+        } else if (topic.durable) {
+            cerr << "No log for durable topic " << topic.name << endl;
+            return 0;
+        } else {
+            uint64_t offset = topic.nextOffset.fetch_add(count);
+            for (size_t i = 0; i < count; i++) {
+                messages[i].offset = offset + i;
+            }
+        }
+        int64_t now = steadyNanos();
+        for (size_t i = 0; i < count; i++) {
+            messages[i].publishedAt = now;
+        }
+        if (topic.groupCount.load() > 0) dispatchToGroups(topic, messages, count);
+        if (mode == DispatchMode::ASYNC) return dispatchToMailboxes(topic, messages, count);
+
+        // Pull mailboxes are filled here rather than from the ring, so a
+        // rejection counts against this publish as it does in ASYNC mode.
+        size_t accepted = topic.mailboxCount.load() > 0 ? dispatchToMailboxes(topic, messages, count) : count;
+        size_t queued = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (enqueue(topic.ring, std::move(messages[i]), topic.dropped, [&] {
+                    deliverMessages(topic);
+                    this_thread::yield();
+                    return true;
+                })) {
+                queued++;
+            } else {
+                topic.dropped++;
+            }
+        }
         deliverMessages(topic);
+        return min(accepted, queued);
+    }
+
+    // A group with no members is skipped, and a producer blocked on one of
+    // its full partitions gives up once the last member leaves.
+    void dispatchToGroups(Topic& topic, const Message* messages, size_t count) {
+        shared_lock<shared_mutex> lock(topic.subscribersMutex);
+        for (auto* group : topic.groups) {
+            if (!group->routing.load()) continue;
+            for (size_t i = 0; i < count; i++) {
+                bool queued = enqueue(*group->partitions[messages[i].partition], messages[i], group->dropped, [group] {
+                    this_thread::yield();
+                    return group->routing.load();
+                });
+                if (!queued) group->dropped++;
+            }
+        }
     }
 
-    void subscribe(const string& topic, void(*callback)(string, string)) {
-        subscribers[topic].push_back(callback);
+    uint32_t nextPartition(Topic& topic) {
+        return topic.partitions == 1 ? 0 : topic.nextPartition.fetch_add(1) % topic.partitions;
     }
 
-    void deliverMessages(const string& topic) {
-        while (!topics[topic].empty()) {
-            string message = topics[topic].front();
-            topics[topic].pop();
+    shared_ptr<ConsumerGroup> findGroup(const string& name) {
+        lock_guard<mutex> lock(groupsMutex);
+        auto it = groups.find(name);
+        return it == groups.end() ? nullptr : it->second;
+    }
+
+    shared_ptr<Subscription> findSubscription(size_t id) {
+        lock_guard<mutex> lock(subscriptionsMutex);
+        auto it = subscriptions.find(id);
+        return it == subscriptions.end() ? nullptr : it->second;
+    }
+
+    // Round-robin over the sorted members. Caller holds membershipMutex
+    // exclusively, so no poll is in flight while ownership moves.
+    static void rebalance(ConsumerGroup& group) {
+        group.assignment.clear();
+        if (group.members.empty()) return;
+        for (const auto& member : group.members) {
+            group.assignment[member];
+        }
+        for (uint32_t p = 0; p < group.partitions.size(); p++) {
+            group.assignment[group.members[p % group.members.size()]].push_back(p);
+        }
+    }
+
+    uint64_t currentTick() const {
+        return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - startTime) / TIMER_TICK;
+    }
+
+    bool schedule(chrono::steady_clock::time_point when, ScheduledMessage scheduled) {
+        uint64_t deadline = chrono::duration_cast<chrono::milliseconds>(when - startTime) / TIMER_TICK;
+        lock_guard<mutex> lock(timerMutex);
+        if (timersStopping) return false;
+        if (!timerThread.joinable()) timerThread = thread([this] { runTimers(); });
+        if (timers.empty()) timers.reset(currentTick());
+        timers.insert(deadline, std::move(scheduled));
+        timerCv.notify_one();
+        return true;
+    }
+
+    void runTimers() {
+        vector<ScheduledMessage> due;
+        unique_lock<mutex> lock(timerMutex);
+        while (!timersStopping) {
+            if (timers.empty()) {
+                timerCv.wait(lock, [&] { return timersStopping || !timers.empty(); });
+                continue;
+            }
+            timers.advance(currentTick(), [&](ScheduledMessage& scheduled) { due.push_back(std::move(scheduled)); });
+            if (due.empty()) {
+                // Sleep until the earliest timer is due; schedule() wakes us
+                // early if an earlier one is added.
+                timerCv.wait_until(lock, startTime + timers.nextDeadline() * TIMER_TICK);
+                continue;
+            }
+
+            lock.unlock();
+            int64_t now = steadyNanos();
+            for (auto& scheduled : due) {
+                if (isExpired(scheduled.message, now)) continue;
+                if (scheduled.target && mode == DispatchMode::ASYNC) {
+                    redeliver(*scheduled.target, scheduled.message);
+                } else {
+                    submitDue(std::move(scheduled));
+                }
+            }
+            due.clear();
+            lock.lock();
+        }
+    }
+
+    void submitDue(ScheduledMessage scheduled) {
+        lock_guard<mutex> lock(dueMutex);
+        if (dueStopping) return;
+        if (dueThreads.empty()) {
+            for (size_t i = 0; i < dueThreadCount; i++) {
+                dueThreads.emplace_back([this] { runDue(); });
+            }
+        }
+        dueQueue.push_back(std::move(scheduled));
+        dueCv.notify_one();
+    }
+
+    void runDue() {
+        unique_lock<mutex> lock(dueMutex);
+        while (true) {
+            dueCv.wait(lock, [&] { return dueStopping || !dueQueue.empty(); });
+            if (dueStopping) break;
+            ScheduledMessage scheduled = std::move(dueQueue.front());
+            dueQueue.pop_front();
+            lock.unlock();
+            if (scheduled.target) {
+                redeliver(*scheduled.target, scheduled.message);
+            } else {
+                publishToTopic(getTopic(scheduled.message.topic), &scheduled.message, 1);
+            }
+            lock.lock();
+        }
+    }
+
+    void redeliver(Subscription& subscription, const Message& message) {
+        shared_lock<shared_mutex> lock(subscription.handlerMutex);
+        if (!subscription.active.load()) return;
+        if (mode == DispatchMode::ASYNC) {
+            // Runs on the timer thread, so it never waits for a slow
+            // subscriber to make room: under BLOCK a retry that finds the
+            // mailbox full goes back on the wheel.
+            if (enqueue(*subscription.mailbox, message, subscription.evicted, [] { return false; })) {
+                subscription.enqueued++;
+                wakeWorker(*workers[subscription.worker]);
+            } else if (policy != BackpressurePolicy::BLOCK ||
+                       !schedule(chrono::steady_clock::now() + subscription.retry.backoff(0),
+                                 {message, subscription.shared_from_this()})) {
+                subscription.rejected++;
+            }
+            return;
+        }
+        subscription.enqueued++;
+        handle(subscription, message);
+        subscription.delivered++;
+    }
+
+    void retryOrDeadLetter(Subscription& subscription, const Message& message) {
+        if (message.attempt < subscription.retry.maxRetries) {
+            Message retry = message;
+            retry.attempt++;
+            auto when = chrono::steady_clock::now() + subscription.retry.backoff(message.attempt);
+            if (schedule(when, {std::move(retry), subscription.shared_from_this()})) {
+                subscription.retried++;
+                return;
+            }
+        }
+        subscription.deadLettered++;
+        Topic& dlq = getTopic(subscription.topic->name + ".dlq");
+        Message dead{message.payload, dlq.id};
+        dead.attempt = message.attempt;
+        publishToTopic(dlq, &dead, 1);
+    }
+
+    // Expired messages are dropped as they are dequeued, never by scanning.
+    // Returns how many were removed from out[start..].
+    static size_t removeExpired(vector<Message>& out, size_t start) {
+        int64_t now = steadyNanos();
+        auto end = remove_if(out.begin() + start, out.end(), [now](const Message& m) { return isExpired(m, now); });
+        size_t removed = out.end() - end;
+        out.erase(end, out.end());
+        return removed;
+    }
+
+    void handle(Subscription& subscription, const Message& message) {
+        if (isExpired(message, steadyNanos())) {
+            subscription.expired++;
+            return;
+        }
+        Delivery delivery{*message.payload, subscription.topic->name, message.offset, message.partition,
+                          message.attempt, message.publishedAt};
+        Ack ack;
+        try {
+            ack = subscription.handler(delivery);
+        } catch (const exception& e) {
+            cerr << "Handler for " << subscription.topic->name << " threw: " << e.what() << endl;
+            ack = Ack::NACK;
+        } catch (...) {
+            ack = Ack::NACK;
+        }
+        if (ack == Ack::ACK) return;
+        subscription.nacked++;
+        retryOrDeadLetter(subscription, message);
+    }
+
+    size_t addSubscription(const string& topic, MessageHandler handler, RetryPolicy retry = RetryPolicy()) {
+        Topic& t = getTopic(topic);
+        bool pull = !handler;
+        auto subscription = make_shared<Subscription>();
+        {
+            lock_guard<mutex> lock(subscriptionsMutex);
+            subscription->id = nextSubscriptionId++;
+            subscriptions.emplace(subscription->id, subscription);
+            subscription->topic = &t;
+            subscription->handler = std::move(handler);
+            subscription->retry = retry;
+            if (mode == DispatchMode::ASYNC || pull) {
+                subscription->mailbox = make_unique<RingBuffer<Message>>(ringCapacity);
+            }
+            if (mode == DispatchMode::ASYNC && !pull) {
+                subscription->worker = subscription->id % workers.size();
+            }
+        }
+        if (mode == DispatchMode::ASYNC && !pull) {
+            Worker& worker = *workers[subscription->worker];
+            lock_guard<mutex> lock(worker.mtx);
+            worker.subscriptions.push_back(subscription);
+            worker.version++;
+        }
+
+        unique_lock<shared_mutex> lock(t.subscribersMutex);
+        t.subscribers.push_back(subscription.get());
+        if (subscription->mailbox) t.mailboxCount++;
+        return subscription->id;
+    }
+
+    // The mailbox write and the read of pending form a store-load pair on
+    // each side (the worker clears pending, then scans the mailboxes), so
+    // both need a full fence; otherwise each can miss the other's store and
+    // the message sits unseen while the worker sleeps.
+    void wakeWorker(Worker& worker) {
+        atomic_thread_fence(memory_order_seq_cst);
+        if (worker.pending.load(memory_order_relaxed) || worker.pending.exchange(true)) return;
+        lock_guard<mutex> lock(worker.mtx);
+        worker.cv.notify_one();
+    }
+
+    // Each subscription is pinned to one worker, so its messages are
+    // delivered in publish order and its handler never runs concurrently.
+    void runWorker(Worker& worker) {
+        vector<shared_ptr<Subscription>> local;
+        uint64_t seen = 0;
+        while (true) {
+            worker.pending.store(false, memory_order_relaxed);
+            atomic_thread_fence(memory_order_seq_cst);
+            {
+                lock_guard<mutex> lock(worker.mtx);
+                if (seen != worker.version) {
+                    local = worker.subscriptions;
+                    seen = worker.version;
+                }
+            }
 
-            if (subscribers.find(topic) != subscribers.end()) {
-                for (auto& callback : subscribers[topic]) {
-                    callback(message, topic);
+            bool didWork = false;
+            Message batch[DELIVERY_BATCH];
+            for (auto& subscription : local) {
+                shared_lock<shared_mutex> handlerLock(subscription->handlerMutex);
+                if (!subscription->active.load()) continue;
+                size_t count = subscription->mailbox->tryPopBatch(batch, DELIVERY_BATCH);
+                for (size_t i = 0; i < count; i++) {
+                    handle(*subscription, batch[i]);
+                    batch[i].payload.reset();
                 }
+                subscription->delivered += count;
+                didWork |= count > 0;
+            }
+            if (didWork) continue;
+
+            unique_lock<mutex> lock(worker.mtx);
+            if (worker.stopping) break;
+            worker.cv.wait(lock, [&] { return worker.stopping || worker.pending.load(); });
+        }
+    }
+
+public:
+    MessageQueue(size_t ringCapacity = 1024, BackpressurePolicy policy = BackpressurePolicy::BLOCK,
+                 DispatchMode mode = DispatchMode::INLINE, size_t workerCount = thread::hardware_concurrency())
+        : ringCapacity(ringCapacity), policy(policy), mode(mode) {
+        dueThreadCount = max<size_t>(workerCount, 1);
+        if (mode == DispatchMode::ASYNC) {
+            workerCount = max<size_t>(workerCount, 1);
+            for (size_t i = 0; i < workerCount; i++) {
+                workers.push_back(make_unique<Worker>());
+            }
+            for (auto& worker : workers) {
+                Worker* w = worker.get();
+                w->runner = thread([this, w] { runWorker(*w); });
+            }
+        }
+    }
+
+    // Stops the workers once every mailbox has been drained. Messages still
+    // waiting for their delivery time, or due but not yet handed on, are
+    // discarded.
+    ~MessageQueue() {
+        {
+            lock_guard<mutex> lock(timerMutex);
+            timersStopping = true;
+            timerCv.notify_one();
+        }
+        if (timerThread.joinable()) timerThread.join();
+        {
+            lock_guard<mutex> lock(dueMutex);
+            dueStopping = true;
+            dueCv.notify_all();
+        }
+        for (auto& dueThread : dueThreads) {
+            dueThread.join();
+        }
+        for (auto& worker : workers) {
+            lock_guard<mutex> lock(worker->mtx);
+            worker->stopping = true;
+            worker->cv.notify_one();
+        }
+        for (auto& worker : workers) {
+            worker->runner.join();
+        }
+    }
+
+    MessageQueue(const MessageQueue&) = delete;
+    MessageQueue& operator=(const MessageQueue&) = delete;
+
+    // Makes every topic durable: messages are appended to
+    // <directory>/<topic>/ segment files of up to segmentBytes before they are
+    // dispatched. Topics found on disk are recovered. Call before publishing.
+    // A topic whose log cannot be opened rejects publishes rather than keep
+    // them in memory only; calling this again retries it.
+    bool enablePersistence(const string& directory, size_t segmentBytes = 64 << 20) {
+        unique_lock<shared_mutex> lock(topicsMutex);
+        error_code ec;
+        filesystem::create_directories(directory, ec);
+        if (ec) return false;
+        persistenceDirectory = directory;
+        this->segmentBytes = segmentBytes;
+
+        bool ok = true;
+        for (auto& topic : topics) {
+            if (!topic->log) ok &= attachLog(*topic);
+        }
+        for (const auto& entry : filesystem::directory_iterator(directory, ec)) {
+            string name = entry.path().filename().string();
+            if (entry.is_directory() && topicIds.find(name) == topicIds.end()) {
+                ok &= addTopic(name).log != nullptr;
             }
         }
+        return ok;
+    }
+
+    // Offset the next message on this topic will get.
+    uint64_t endOffset(const string& topic) {
+        Topic& t = getTopic(topic);
+        return t.log ? t.log->endOffset() : t.nextOffset.load();
+    }
+
+    // Reads persisted messages from any offset via the mapped segments,
+    // e.g. to bring a late subscriber up to date. visit(offset, payload) is
+    // called in offset order. Returns the offset to continue from.
+    template <typename Visitor>
+    uint64_t replay(const string& topic, uint64_t fromOffset, size_t maxMessages, Visitor visit) {
+        Topic& t = getTopic(topic);
+        if (!t.log) return fromOffset;
+        return t.log->read(fromOffset, maxMessages, visit);
+    }
+
+    bool syncLogs() {
+        shared_lock<shared_mutex> lock(topicsMutex);
+        bool ok = true;
+        for (auto& topic : topics) {
+            if (topic->log) ok &= topic->log->sync();
+        }
+        return ok;
+    }
+
+    // Topics default to a single partition; a partitioned topic has to be
+    // created before it is first used. Fails if the topic exists, or its
+    // log cannot be opened while persistence is enabled.
+    bool createTopic(const string& topic, uint32_t partitions) {
+        unique_lock<shared_mutex> lock(topicsMutex);
+        if (partitions == 0 || topicIds.find(topic) != topicIds.end()) return false;
+        Topic& t = addTopic(topic, partitions);
+        if (t.durable && !t.log) {
+            // Nothing can have seen it yet, so take it back out.
+            topicIds.erase(topic);
+            topics.pop_back();
+            return false;
+        }
+        return true;
+    }
+
+    uint32_t partitionCount(const string& topic) {
+        return getTopic(topic).partitions;
+    }
+
+    // Adds memberId to the group (created on first join) and rebalances
+    // partition ownership across the members.
+    bool joinGroup(const string& group, const string& topic, const string& memberId) {
+        Topic& t = getTopic(topic);
+        shared_ptr<ConsumerGroup> g;
+        {
+            lock_guard<mutex> lock(groupsMutex);
+            auto& slot = groups[group];
+            if (!slot) {
+                slot = make_shared<ConsumerGroup>();
+                slot->name = group;
+                slot->topic = &t;
+                for (uint32_t p = 0; p < t.partitions; p++) {
+                    slot->partitions.push_back(make_unique<RingBuffer<Message>>(ringCapacity));
+                }
+                unique_lock<shared_mutex> topicLock(t.subscribersMutex);
+                t.groups.push_back(slot.get());
+                t.groupCount++;
+            }
+            g = slot;
+        }
+        if (g->topic != &t) return false;
+
+        unique_lock<shared_mutex> lock(g->membershipMutex);
+        if (g->deleted) return false;
+        auto it = lower_bound(g->members.begin(), g->members.end(), memberId);
+        if (it != g->members.end() && *it == memberId) return true;
+        g->members.insert(it, memberId);
+        rebalance(*g);
+        g->routing = true;
+        return true;
+    }
+
+    // The member's partitions, and whatever is queued on them, move to the
+    // remaining members. Once the last member leaves, the group keeps its
+    // backlog but receives nothing new until someone joins again.
+    void leaveGroup(const string& group, const string& memberId) {
+        auto g = findGroup(group);
+        if (!g) return;
+        unique_lock<shared_mutex> lock(g->membershipMutex);
+        auto it = lower_bound(g->members.begin(), g->members.end(), memberId);
+        if (it == g->members.end() || *it != memberId) return;
+        g->members.erase(it);
+        rebalance(*g);
+        if (g->members.empty()) g->routing = false;
+    }
+
+    // Detaches the group from its topic and discards its backlog. Remaining
+    // members poll nothing; joining the name again starts a fresh group.
+    bool deleteGroup(const string& group) {
+        shared_ptr<ConsumerGroup> g;
+        {
+            lock_guard<mutex> lock(groupsMutex);
+            auto it = groups.find(group);
+            if (it == groups.end()) return false;
+            g = std::move(it->second);
+            groups.erase(it);
+        }
+        {
+            unique_lock<shared_mutex> lock(g->membershipMutex);
+            g->deleted = true;
+            g->routing = false;
+            g->members.clear();
+            g->assignment.clear();
+        }
+        // Producers stuck on a full partition see routing drop and release
+        // the subscriber list.
+        Topic& t = *g->topic;
+        unique_lock<shared_mutex> lock(t.subscribersMutex);
+        t.groups.erase(find(t.groups.begin(), t.groups.end(), g.get()));
+        t.groupCount--;
+        return true;
+    }
+
+    vector<uint32_t> assignedPartitions(const string& group, const string& memberId) {
+        auto g = findGroup(group);
+        if (!g) return {};
+        shared_lock<shared_mutex> lock(g->membershipMutex);
+        auto it = g->assignment.find(memberId);
+        return it == g->assignment.end() ? vector<uint32_t>() : it->second;
+    }
+
+    // Appends up to maxMessages from the partitions memberId owns.
+    size_t pollGroup(const string& group, const string& memberId, size_t maxMessages, vector<Message>& out) {
+        auto g = findGroup(group);
+        if (!g) return 0;
+        shared_lock<shared_mutex> lock(g->membershipMutex);
+        auto it = g->assignment.find(memberId);
+        if (it == g->assignment.end()) return 0;
+
+        size_t start = out.size();
+        out.resize(start + maxMessages);
+        size_t total = 0;
+        for (uint32_t partition : it->second) {
+            while (total < maxMessages) {
+                size_t count = g->partitions[partition]->tryPopBatch(out.data() + start + total,
+                                                                   min(maxMessages - total, DELIVERY_BATCH));
+                if (count == 0) break;
+                total += count;
+            }
+        }
+        out.resize(start + total);
+        return total - removeExpired(out, start);
+    }
+
+    TopicId topicId(const string& topic) {
+        return getTopic(topic).id;
+    }
+
+    const string& topicName(TopicId topic) {
+        return getTopic(topic).name;
+    }
+
+    bool publish(const string& topic, string message) {
+        return publish(getTopic(topic).id, make_shared<const string>(std::move(message)));
+    }
+
+    // Hot-path overload: no name hashing and no payload copy.
+    bool publish(TopicId topic, shared_ptr<const string> payload) {
+        Topic& t = getTopic(topic);
+        Message message{std::move(payload), t.id};
+        message.partition = nextPartition(t);
+        return publishToTopic(t, &message, 1) == 1;
+    }
+
+    // The message becomes visible to subscribers at `when` and, if ttl is
+    // non-zero, is dropped unseen once it has been visible for ttl.
+    bool publishAt(const string& topic, string message, chrono::steady_clock::time_point when,
+                   chrono::milliseconds ttl = chrono::milliseconds(0)) {
+        Topic& t = getTopic(topic);
+        Message m{make_shared<const string>(std::move(message)), t.id};
+        m.partition = nextPartition(t);
+        auto visibleAt = max(when, chrono::steady_clock::now());
+        if (ttl.count() > 0) {
+            m.expiresAt = chrono::duration_cast<chrono::nanoseconds>((visibleAt + ttl).time_since_epoch()).count();
+        }
+        if (when <= chrono::steady_clock::now()) return publishToTopic(t, &m, 1) == 1;
+        return schedule(when, {std::move(m), nullptr});
+    }
+
+    bool publishAfter(const string& topic, string message, chrono::milliseconds delay,
+                      chrono::milliseconds ttl = chrono::milliseconds(0)) {
+        return publishAt(topic, std::move(message), chrono::steady_clock::now() + delay, ttl);
+    }
+
+    size_t pendingDelayed() {
+        lock_guard<mutex> lock(timerMutex);
+        return timers.size();
+    }
+
+    // Messages with the same key always land in the same partition.
+    bool publish(const string& topic, const string& key, string message) {
+        Topic& t = getTopic(topic);
+        Message m{make_shared<const string>(std::move(message)), t.id};
+        m.partition = (uint32_t)(hash<string>{}(key) % t.partitions);
+        return publishToTopic(t, &m, 1) == 1;
+    }
+
+    // One topic lookup, one subscriber-list lock and one delivery pass for
+    // the whole batch. Returns how many messages were accepted.
+    size_t publishBatch(const string& topic, const vector<string>& messages) {
+        Topic& t = getTopic(topic);
+        vector<Message> batch;
+        batch.reserve(messages.size());
+        uint32_t partition = nextPartition(t);
+        for (const auto& message : messages) {
+            batch.push_back({make_shared<const string>(message), t.id, 0, partition});
+        }
+        return publishToTopic(t, batch.data(), batch.size());
+    }
+
+    size_t publishBatch(TopicId topic, const vector<shared_ptr<const string>>& payloads) {
+        Topic& t = getTopic(topic);
+        vector<Message> batch;
+        batch.reserve(payloads.size());
+        uint32_t partition = nextPartition(t);
+        for (const auto& payload : payloads) {
+            batch.push_back({payload, t.id, 0, partition});
+        }
+        return publishToTopic(t, batch.data(), batch.size());
+    }
+
+    // In ASYNC mode a handler is only ever run by one worker at a time. In
+    // INLINE mode it runs on whichever thread publishes, so a handler shared
+    // by concurrent producers must guard its own state.
+    size_t subscribe(const string& topic, MessageHandler handler, RetryPolicy retry = RetryPolicy()) {
+        return addSubscription(topic, std::move(handler), retry);
+    }
+
+    // Stateless callbacks get views into the shared payload and the interned
+    // topic name; they are only valid for the duration of the call.
+    size_t subscribe(const string& topic, void(*callback)(string_view, string_view)) {
+        return addSubscription(topic, [callback](const Delivery& delivery) {
+            callback(delivery.payload, delivery.topic);
+        });
+    }
+
+    // Messages for a pull subscription wait in its mailbox until polled.
+    size_t subscribePull(const string& topic) {
+        return addSubscription(topic, MessageHandler());
+    }
+
+    // Appends up to maxMessages to out, claimed from the mailbox in
+    // DELIVERY_BATCH-sized chunks. Returns how many were appended.
+    size_t poll(size_t subscriptionId, size_t maxMessages, vector<Message>& out) {
+        shared_ptr<Subscription> subscription = findSubscription(subscriptionId);
+        if (!subscription || subscription->handler || !subscription->active.load()) return 0;
+
+        size_t start = out.size();
+        out.resize(start + maxMessages);
+        size_t total = 0;
+        while (total < maxMessages) {
+            size_t count = subscription->mailbox->tryPopBatch(out.data() + start + total,
+                                                             min(maxMessages - total, DELIVERY_BATCH));
+            if (count == 0) break;
+            total += count;
+        }
+        out.resize(start + total);
+        subscription->delivered += total;
+        size_t expired = removeExpired(out, start);
+        subscription->expired += expired;
+        return total - expired;
+    }
+
+    vector<Message> poll(size_t subscriptionId, size_t maxMessages) {
+        vector<Message> out;
+        poll(subscriptionId, maxMessages, out);
+        return out;
+    }
+
+    // Stops deliveries to the subscription and discards whatever is still
+    // queued for it; pending retries are dropped when they fall due, and the
+    // subscription is freed with the last of them. Once this returns the
+    // handler is not running and never runs again, so it may be destroyed.
+    // Must not be called from a handler.
+    bool unsubscribe(size_t subscriptionId) {
+        shared_ptr<Subscription> subscription;
+        {
+            lock_guard<mutex> lock(subscriptionsMutex);
+            auto it = subscriptions.find(subscriptionId);
+            if (it == subscriptions.end()) return false;
+            subscription = std::move(it->second);
+            subscriptions.erase(it);
+        }
+        // Producers blocked on this mailbox give up once active drops, so
+        // they release the subscriber list.
+        if (!subscription->active.exchange(false)) return false;
+        Topic& t = *subscription->topic;
+        {
+            unique_lock<shared_mutex> lock(t.subscribersMutex);
+            t.subscribers.erase(find(t.subscribers.begin(), t.subscribers.end(), subscription.get()));
+            if (subscription->mailbox) t.mailboxCount--;
+        }
+        if (mode == DispatchMode::ASYNC && subscription->handler) {
+            Worker& worker = *workers[subscription->worker];
+            lock_guard<mutex> lock(worker.mtx);
+            worker.subscriptions.erase(find(worker.subscriptions.begin(), worker.subscriptions.end(), subscription));
+            worker.version++;
+        }
+        unique_lock<shared_mutex> lock(subscription->handlerMutex);
+        if (subscription->mailbox) {
+            Message discarded;
+            while (subscription->mailbox->tryPop(discarded)) {}
+        }
+        return true;
+    }
+
+    void deliverMessages(const string& topic) {
+        deliverMessages(getTopic(topic));
+    }
+
+    size_t droppedMessages(const string& topic) {
+        return getTopic(topic).dropped.load();
+    }
+
+    // Per-subscription cursors for live subscriptions, in id order; lag is
+    // how many accepted messages are still waiting in the subscriber's
+    // mailbox. Rejected messages were never enqueued, so only evictions
+    // count against it.
+    vector<SubscriberLag> subscriberLag() {
+        vector<SubscriberLag> result;
+        lock_guard<mutex> lock(subscriptionsMutex);
+        for (auto& [id, subscription] : subscriptions) {
+            uint64_t delivered = subscription->delivered.load();
+            uint64_t evicted = subscription->evicted.load();
+            uint64_t enqueued = subscription->enqueued.load();
+            uint64_t done = delivered + evicted;
+            result.push_back({id, subscription->topic->name, enqueued, delivered, evicted,
+                              subscription->rejected.load(), subscription->nacked.load(), subscription->expired.load(),
+                              subscription->retried.load(), subscription->deadLettered.load(),
+                              enqueued > done ? enqueued - done : 0});
+        }
+        sort(result.begin(), result.end(),
+             [](const SubscriberLag& a, const SubscriberLag& b) { return a.subscriptionId < b.subscriptionId; });
+        return result;
     }
 };
 
@@ -41,31 +1615,342 @@ private:
 
 public:
     Producer(const string& id, shared_ptr<MessageQueue> queue) : id(id), queue(queue) {}
-    void publish(const string& topic, const string& message) {
+    bool publish(const string& topic, const string& message) {
         cout << "[Producer " << id << "] Published: " << message << " to " << topic << endl;
-        queue->publish(topic, message);
+        if (!queue->publish(topic, message)) {
+            cout << "[Producer " << id << "] Queue full, rejected: " << message << endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool publish(const string& topic, const string& key, const string& message) {
+        cout << "[Producer " << id << "] Published: " << message << " to " << topic << " (key " << key << ")" << endl;
+        if (!queue->publish(topic, key, message)) {
+            cout << "[Producer " << id << "] Queue full, rejected: " << message << endl;
+            return false;
+        }
+        return true;
+    }
+
+    size_t publishBatch(const string& topic, const vector<string>& messages) {
+        size_t accepted = queue->publishBatch(topic, messages);
+        cout << "[Producer " << id << "] Published batch: " << accepted << "/" << messages.size()
+             << " messages to " << topic << endl;
+        return accepted;
     }
 };
 
+// Subscribed handlers point back at the consumer, so it cannot be copied or
+// moved; it unsubscribes on destruction, so no delivery or retry outlives it.
 class Consumer {
 private:
     string id;
+    shared_ptr<MessageQueue> queue;
+    vector<size_t> subscriptions;
+    atomic<uint64_t> processed{0};  // INLINE handlers run on every publishing thread
 
-    static void consumeMessage(string message, string consumerId) {
-        cout << consumerId << " received " << message << endl;
+    Ack consumeMessage(const Delivery& delivery) {
+        processed++;
+        cout << id << " received " << delivery.payload << " from " << delivery.topic << endl;
+        return Ack::ACK;
     }
 
 public:
-    Consumer(const string& id, shared_ptr<MessageQueue> queue, vector<string> topics) : id(id) {
+    Consumer(const string& id, shared_ptr<MessageQueue> queue, vector<string> topics) : id(id), queue(queue) {
         for (const auto& topic : topics) {
-            queue->subscribe(topic, [](string message, string consumerId) {
-                cout << consumerId << " received " << message << endl;
-            });
+            subscriptions.push_back(
+                queue->subscribe(topic, [this](const Delivery& delivery) { return consumeMessage(delivery); }));
+        }
+    }
+
+    ~Consumer() {
+        for (size_t subscription : subscriptions) {
+            queue->unsubscribe(subscription);
+        }
+    }
+
+    Consumer(const Consumer&) = delete;
+    Consumer& operator=(const Consumer&) = delete;
+
+    uint64_t processedCount() const { return processed.load(); }
+};
+
+// Pulls batches instead of registering a callback.
+class PollingConsumer {
+private:
+    string id;
+    shared_ptr<MessageQueue> queue;
+    vector<size_t> subscriptions;
+
+public:
+    PollingConsumer(const string& id, shared_ptr<MessageQueue> queue, vector<string> topics) : id(id), queue(queue) {
+        for (const auto& topic : topics) {
+            subscriptions.push_back(queue->subscribePull(topic));
         }
     }
+
+    ~PollingConsumer() {
+        for (size_t subscription : subscriptions) {
+            queue->unsubscribe(subscription);
+        }
+    }
+
+    PollingConsumer(const PollingConsumer&) = delete;
+    PollingConsumer& operator=(const PollingConsumer&) = delete;
+
+    vector<Message> poll(size_t maxMessages) {
+        vector<Message> batch;
+        batch.reserve(maxMessages);
+        for (size_t subscription : subscriptions) {
+            if (batch.size() == maxMessages) break;
+            queue->poll(subscription, maxMessages - batch.size(), batch);
+        }
+        return batch;
+    }
+};
+
+// Member of a consumer group; owns a share of the topic's partitions for
+// as long as it lives.
+class GroupConsumer {
+private:
+    string id;
+    string group;
+    shared_ptr<MessageQueue> queue;
+
+public:
+    GroupConsumer(const string& id, shared_ptr<MessageQueue> queue, const string& group, const string& topic)
+        : id(id), group(group), queue(queue) {
+        queue->joinGroup(group, topic, id);
+    }
+
+    ~GroupConsumer() {
+        queue->leaveGroup(group, id);
+    }
+
+    GroupConsumer(const GroupConsumer&) = delete;
+    GroupConsumer& operator=(const GroupConsumer&) = delete;
+
+    vector<uint32_t> partitions() {
+        return queue->assignedPartitions(group, id);
+    }
+
+    vector<Message> poll(size_t maxMessages) {
+        vector<Message> batch;
+        batch.reserve(maxMessages);
+        queue->pollGroup(group, id, maxMessages, batch);
+        return batch;
+    }
 };
 
-int main() {
+// HDR-style log-linear histogram of nanosecond values: exact below 128,
+// then 64 sub-buckets per power of two (under 1.6% relative error) up to
+// 2^64. Recording is a relaxed atomic increment, so many threads can share
+// one.
+class LatencyHistogram {
+private:
+    static constexpr int SUB_BUCKET_BITS = 6;
+    static constexpr uint64_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr size_t BUCKETS = 2 * SUB_BUCKETS + (63 - SUB_BUCKET_BITS) * SUB_BUCKETS;
+
+    unique_ptr<atomic<uint64_t>[]> counts;
+
+    static size_t bucketFor(uint64_t value) {
+        if (value < 2 * SUB_BUCKETS) return value;
+        int shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+        return 2 * SUB_BUCKETS + (shift - 1) * SUB_BUCKETS + ((value >> shift) - SUB_BUCKETS);
+    }
+
+    // Highest value that lands in the bucket.
+    static uint64_t valueFor(size_t bucket) {
+        if (bucket < 2 * SUB_BUCKETS) return bucket;
+        int shift = (bucket - 2 * SUB_BUCKETS) / SUB_BUCKETS + 1;
+        uint64_t mantissa = (bucket - 2 * SUB_BUCKETS) % SUB_BUCKETS + SUB_BUCKETS;
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+public:
+    LatencyHistogram() : counts(new atomic<uint64_t>[BUCKETS]) {
+        for (size_t i = 0; i < BUCKETS; i++) counts[i].store(0, memory_order_relaxed);
+    }
+
+    void record(int64_t nanos) {
+        counts[bucketFor(nanos < 0 ? 0 : nanos)].fetch_add(1, memory_order_relaxed);
+    }
+
+    uint64_t count() const {
+        uint64_t total = 0;
+        for (size_t i = 0; i < BUCKETS; i++) total += counts[i].load(memory_order_relaxed);
+        return total;
+    }
+
+    // q in [0, 1]; returns 0 when nothing was recorded.
+    uint64_t percentile(double q) const {
+        uint64_t total = count();
+        if (total == 0) return 0;
+        uint64_t target = max<uint64_t>(1, (uint64_t)(q * total + 0.5));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; i++) {
+            seen += counts[i].load(memory_order_relaxed);
+            if (seen >= target) return valueFor(i);
+        }
+        return valueFor(BUCKETS - 1);
+    }
+};
+
+struct BenchmarkConfig {
+    size_t producers;
+    size_t consumers;  // subscriptions per topic, and async workers
+    size_t topics;
+    size_t messageBytes;
+    size_t batchSize;
+};
+
+struct BenchmarkResult {
+    BenchmarkConfig config;
+    uint64_t messages;
+    uint64_t deliveries;
+    double seconds;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t maxLatency;
+};
+
+// One run: producers publish round-robin over the topics as fast as the
+// BLOCK backpressure lets them, and every consumer on a topic records
+// publish-to-deliver latency. Throughput is measured until the last
+// delivery, so it is end-to-end rather than just publish rate.
+BenchmarkResult runBenchmark(const BenchmarkConfig& config, size_t totalMessages) {
+    MessageQueue queue(4096, BackpressurePolicy::BLOCK, DispatchMode::ASYNC, config.consumers);
+    LatencyHistogram histogram;
+    atomic<uint64_t> delivered{0};
+
+    vector<TopicId> topics;
+    for (size_t t = 0; t < config.topics; t++) {
+        string name = "bench-" + to_string(t);
+        topics.push_back(queue.topicId(name));
+        for (size_t c = 0; c < config.consumers; c++) {
+            queue.subscribe(name, [&histogram, &delivered](const Delivery& delivery) {
+                histogram.record(steadyNanos() - delivery.publishedAt);
+                delivered.fetch_add(1, memory_order_relaxed);
+            });
+        }
+    }
+
+    size_t perProducer = totalMessages / config.producers / config.batchSize * config.batchSize;
+    uint64_t messages = perProducer * config.producers;
+    uint64_t expected = messages * config.consumers;
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> producers;
+    for (size_t p = 0; p < config.producers; p++) {
+        producers.emplace_back([&, p] {
+            auto payload = make_shared<const string>(config.messageBytes, 'x');
+            vector<shared_ptr<const string>> batch(config.batchSize, payload);
+            size_t topic = p % topics.size();
+            for (size_t sent = 0; sent < perProducer; sent += config.batchSize) {
+                if (config.batchSize == 1) {
+                    queue.publish(topics[topic], payload);
+                } else {
+                    queue.publishBatch(topics[topic], batch);
+                }
+                topic = (topic + 1) % topics.size();
+            }
+        });
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    while (delivered.load() < expected) {
+        this_thread::yield();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    return {config, messages, expected, seconds, histogram.percentile(0.50), histogram.percentile(0.99),
+            histogram.percentile(0.999), histogram.percentile(1.0)};
+}
+
+string benchmarkResultsToJson(const vector<BenchmarkResult>& results) {
+    ostringstream json;
+    json << "{\n  \"benchmark\": \"inmemoryqueue\",\n  \"latency_unit\": \"ns\",\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto& r = results[i];
+        json << (i ? "," : "") << "\n    {"
+             << "\"producers\": " << r.config.producers << ", "
+             << "\"consumers\": " << r.config.consumers << ", "
+             << "\"topics\": " << r.config.topics << ", "
+             << "\"message_bytes\": " << r.config.messageBytes << ", "
+             << "\"batch_size\": " << r.config.batchSize << ", "
+             << "\"messages\": " << r.messages << ", "
+             << "\"deliveries\": " << r.deliveries << ", "
+             << "\"seconds\": " << r.seconds << ", "
+             << "\"messages_per_sec\": " << (uint64_t)(r.messages / r.seconds) << ", "
+             << "\"deliveries_per_sec\": " << (uint64_t)(r.deliveries / r.seconds) << ", "
+             << "\"p50\": " << r.p50 << ", "
+             << "\"p99\": " << r.p99 << ", "
+             << "\"p999\": " << r.p999 << ", "
+             << "\"max\": " << r.maxLatency << "}";
+    }
+    json << "\n  ]\n}\n";
+    return json.str();
+}
+
+// bench [--messages N] [--out results.json]
+// Sweeps producer, consumer and topic counts, message size and batch size.
+// Progress goes to stderr; the JSON report to --out, or stdout.
+int runBenchmarkSuite(int argc, char* argv[]) {
+    size_t messages = 200000;
+    string outPath;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        string flag = argv[i];
+        if (flag == "--messages") {
+            messages = stoull(argv[i + 1]);
+        } else if (flag == "--out") {
+            outPath = argv[i + 1];
+        } else {
+            cerr << "Unknown option " << flag << endl;
+            return 1;
+        }
+    }
+
+    vector<BenchmarkResult> results;
+    for (size_t producers : {1, 2, 4}) {
+        for (size_t consumers : {1, 2, 4}) {
+            for (size_t topics : {1, 8}) {
+                for (size_t messageBytes : {16, 256, 4096}) {
+                    for (size_t batchSize : {1, 64}) {
+                        BenchmarkResult r = runBenchmark({producers, consumers, topics, messageBytes, batchSize}, messages);
+                        cerr << "producers=" << producers << " consumers=" << consumers << " topics=" << topics
+                             << " bytes=" << messageBytes << " batch=" << batchSize
+                             << " msgs/sec=" << (uint64_t)(r.messages / r.seconds) << " p50=" << r.p50
+                             << "ns p99=" << r.p99 << "ns p999=" << r.p999 << "ns" << endl;
+                        results.push_back(r);
+                    }
+                }
+            }
+        }
+    }
+
+    string json = benchmarkResultsToJson(results);
+    if (outPath.empty()) {
+        cout << json;
+    } else {
+        ofstream out(outPath);
+        out << json;
+        if (!out) {
+            cerr << "Failed to write " << outPath << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && string(argv[1]) == "bench") {
+        return runBenchmarkSuite(argc, argv);
+    }
+
     auto queue = make_shared<MessageQueue>();
 
     // Creating topics
@@ -90,5 +1975,34 @@ int main() {
     producer1.publish(topic2, "Message 4");
     producer2.publish(topic2, "Message 5");
 
+    // Batch publish and batch poll
+    PollingConsumer poller("poller", queue, {topic2});
+    producer1.publishBatch(topic2, {"Message 6", "Message 7", "Message 8"});
+    for (const auto& message : poller.poll(10)) {
+        cout << "poller received " << *message.payload << endl;
+    }
+
+    // Delayed delivery and per-message TTL
+    queue->publishAfter(topic2, "Reminder", chrono::milliseconds(20));
+    queue->publishAfter(topic2, "Flash sale", chrono::milliseconds(0), chrono::milliseconds(1));
+    this_thread::sleep_for(chrono::milliseconds(50));
+    for (const auto& message : poller.poll(10)) {
+        cout << "poller received " << *message.payload << endl;
+    }
+
+    // Partitioned topic shared by a consumer group
+    queue->createTopic("orders", 4);
+    GroupConsumer worker1("worker1", queue, "billing", "orders");
+    GroupConsumer worker2("worker2", queue, "billing", "orders");
+    producer1.publish("orders", "alice", "Order A");
+    producer2.publish("orders", "carol", "Order B");
+    producer1.publish("orders", "alice", "Order C");
+    for (const auto& message : worker1.poll(10)) {
+        cout << "worker1 received " << *message.payload << " from partition " << message.partition << endl;
+    }
+    for (const auto& message : worker2.poll(10)) {
+        cout << "worker2 received " << *message.payload << " from partition " << message.partition << endl;
+    }
+
     return 0;
 }
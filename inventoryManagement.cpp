@@ -1,105 +1,1776 @@
 #include <iostream>
 #include <unordered_map>
 #include <vector>
+#include <array>
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <memory>
+#include <queue>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <fstream>
+#include <filesystem>
+#include <cstring>
+#include <cstdio>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
 
 using namespace std;
 using namespace std::chrono;
 
-struct Product {
-    string name;
-    int inventoryCount;
+// Dense index a product id is interned into when the product is first
+// created. It never changes, so hot paths can skip hashing the id.
+typedef uint32_t ProductHandle;
+const ProductHandle INVALID_PRODUCT = UINT32_MAX;
+
+typedef uint32_t WarehouseId;
+const WarehouseId DEFAULT_WAREHOUSE = 0;
+const WarehouseId INVALID_WAREHOUSE = UINT32_MAX;
+
+// Units of one product held in one warehouse.
+struct WarehouseStock {
+    WarehouseId warehouse;
+    int available;
+};
+
+// Units of one product reserved from one warehouse. An order's allocations
+// are grouped by warehouse; each group is one shipment.
+struct Allocation {
+    ProductHandle product;
+    WarehouseId warehouse;
+    int quantity;
 };
 
 struct Order {
-    vector<string> productIds;
+    vector<ProductHandle> products;  // distinct, with the units reserved of each
     vector<int> quantities;
+    vector<Allocation> allocations;
     time_point<steady_clock> orderTime;
     bool confirmed;
+    int64_t expiresAt;  // wall-clock ms, so a restart can re-arm the reservation
 };
 
-class InventoryManager {
+// One product's counters, read together under its stripe. sold counts the
+// units of confirmed orders; warehoused is the per-warehouse stock summed,
+// which always equals available.
+struct StockLevels {
+    int available;
+    int blocked;
+    int sold;
+    int warehoused;
+};
+
+// Positive deltas stock in, negative ones ship out of available inventory.
+struct StockDelta {
+    string productId;
+    int delta;
+    WarehouseId warehouse = DEFAULT_WAREHOUSE;
+};
+
+// NOT_DURABLE: applied in memory, but the log could not be written, so the
+// change may not survive a restart.
+enum class DeltaResult { APPLIED, UNKNOWN_PRODUCT, UNKNOWN_WAREHOUSE, INSUFFICIENT_STOCK, INVALID, NOT_DURABLE };
+
+struct OrderRequest {
+    string orderId;
+    vector<string> productIds;
+    vector<int> quantities;
+};
+
+// PARTIALLY_RESERVED only happens with partial fulfillment switched on.
+enum class OrderResult { RESERVED, PARTIALLY_RESERVED, UNKNOWN_PRODUCT, INSUFFICIENT_STOCK, DUPLICATE_ORDER, INVALID, NOT_DURABLE };
+
+// A product's available count crossed its low-stock threshold: low is true
+// when it fell below, false when it came back up. Alerts may reach a sink
+// out of order across threads; sequence orders those for one product.
+struct StockAlert {
+    string productId;
+    ProductHandle handle;
+    int available;
+    int threshold;
+    bool low;
+    uint64_t sequence;
+};
+
+class AlertSink {
+public:
+    virtual ~AlertSink() = default;
+    // Called outside every inventory lock, possibly from several threads.
+    virtual void onAlert(const StockAlert& alert) = 0;
+};
+
+class ConsoleAlertSink : public AlertSink {
 private:
-    unordered_map<string, Product> inventory;
-    unordered_map<string, Order> orders;
-    unordered_map<string, int> blockedInventory;
     mutex mtx;
 
 public:
-    void createProduct(string productId, string name, int count) {
+    void onAlert(const StockAlert& alert) override {
         lock_guard<mutex> lock(mtx);
-        inventory[productId] = {name, count};
-        cout << "Product created: " << productId << " -> (" << name << ", " << count << ")" << endl;
+        cout << "Stock alert: " << alert.productId << (alert.low ? " below " : " back above ")
+             << "threshold " << alert.threshold << " (available " << alert.available << ")" << endl;
     }
+};
 
-    int getInventory(string productId) {
+// Forwards at most one alert per product per window: its latest state, and
+// only if that differs from the last one forwarded. A product that dips
+// below and recovers within one window is never reported downstream.
+class CoalescingAlertSink : public AlertSink {
+private:
+    shared_ptr<AlertSink> downstream;
+    milliseconds window;
+    unordered_map<ProductHandle, StockAlert> pending;
+    mutex mtx;
+    condition_variable cv;
+    bool stopping = false;
+
+    unordered_map<ProductHandle, bool> reported;  // guarded by flushMtx
+    mutex flushMtx;
+    thread flusher;
+
+    void run() {
+        unique_lock<mutex> lock(mtx);
+        while (!cv.wait_for(lock, window, [&] { return stopping; })) {
+            lock.unlock();
+            flush();
+            lock.lock();
+        }
+    }
+
+public:
+    CoalescingAlertSink(shared_ptr<AlertSink> downstream, milliseconds window = seconds(1))
+        : downstream(move(downstream)), window(window) {
+        flusher = thread(&CoalescingAlertSink::run, this);
+    }
+
+    ~CoalescingAlertSink() {
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+        }
+        cv.notify_one();
+        flusher.join();
+        flush();
+    }
+
+    CoalescingAlertSink(const CoalescingAlertSink&) = delete;
+    CoalescingAlertSink& operator=(const CoalescingAlertSink&) = delete;
+
+    void onAlert(const StockAlert& alert) override {
         lock_guard<mutex> lock(mtx);
-        if (inventory.find(productId) != inventory.end()) {
-            return inventory[productId].inventoryCount;
+        auto inserted = pending.insert({alert.handle, alert});
+        if (!inserted.second && alert.sequence > inserted.first->second.sequence) {
+            inserted.first->second = alert;
+        }
+    }
+
+    void flush() {
+        lock_guard<mutex> flushLock(flushMtx);
+        unordered_map<ProductHandle, StockAlert> batch;
+        {
+            lock_guard<mutex> lock(mtx);
+            batch.swap(pending);
+        }
+        for (const auto& entry : batch) {
+            bool& low = reported[entry.first];
+            if (low == entry.second.low) continue;
+            low = entry.second.low;
+            downstream->onAlert(entry.second);
         }
-        return -1;
     }
+};
+
+int64_t epochMillis() {
+    return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+bool writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = ::write(fd, data, size);
+        if (written < 0) return false;
+        data += written;
+        size -= written;
+    }
+    return true;
+}
 
-    void createOrder(vector<string> productIds, vector<int> quantityOrdered, string orderId) {
+bool readFile(const string& path, string& data) {
+    ifstream in(path, ios::binary);
+    if (!in) return false;
+    in.seekg(0, ios::end);
+    data.resize(in.tellg());
+    in.seekg(0);
+    return (bool)in.read(&data[0], data.size());
+}
+
+enum class EventType : uint8_t {
+    PRODUCT = 1,
+    STOCK_DELTA,
+    RESERVED,
+    CONFIRMED,
+    RELEASED,
+    SNAPSHOT_HEADER,
+    SNAPSHOT_PRODUCT,
+    SNAPSHOT_ORDER,
+    WAREHOUSE,
+};
+
+uint32_t checksum(const char* data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ (uint8_t)data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Appends one record to out: [uint32 length][uint32 checksum][body], where
+// the body is [uint8 type][int64 wall-clock ms][fields...]. The timestamp
+// makes the log usable as an audit trail.
+class RecordWriter {
+private:
+    string& out;
+    size_t start;
+
+public:
+    RecordWriter(string& out, EventType type) : out(out), start(out.size()) {
+        out.append(2 * sizeof(uint32_t), '\0');
+        put((uint8_t)type);
+        put(epochMillis());
+    }
+
+    template <typename T>
+    RecordWriter& put(T value) {
+        out.append((const char*)&value, sizeof(value));
+        return *this;
+    }
+
+    RecordWriter& put(const string& value) {
+        put((uint32_t)value.size());
+        out.append(value);
+        return *this;
+    }
+
+    void done() {
+        uint32_t length = out.size() - start - 2 * sizeof(uint32_t);
+        uint32_t sum = checksum(out.data() + start + 2 * sizeof(uint32_t), length);
+        memcpy(&out[start], &length, sizeof(length));
+        memcpy(&out[start + sizeof(length)], &sum, sizeof(sum));
+    }
+};
+
+// Reads the fields of one record body; ok turns false on a short read.
+class RecordReader {
+private:
+    const char* pos = nullptr;
+    const char* end = nullptr;
+
+public:
+    bool ok = true;
+
+    RecordReader() = default;
+    RecordReader(const char* pos, const char* end) : pos(pos), end(end) {}
+
+    template <typename T>
+    T get() {
+        T value{};
+        if ((size_t)(end - pos) < sizeof(T)) {
+            ok = false;
+            return value;
+        }
+        memcpy(&value, pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    string getString() {
+        uint32_t length = get<uint32_t>();
+        if (!ok || (size_t)(end - pos) < length) {
+            ok = false;
+            return string();
+        }
+        string value(pos, length);
+        pos += length;
+        return value;
+    }
+};
+
+// Parses the record at pos and advances past it. Fails on a torn or
+// corrupted record, leaving pos where it started.
+bool nextRecord(const string& data, size_t& pos, EventType& type, RecordReader& body) {
+    uint32_t header[2];
+    if (data.size() - pos < sizeof(header)) return false;
+    memcpy(header, data.data() + pos, sizeof(header));
+    const char* begin = data.data() + pos + sizeof(header);
+    if (data.size() - pos - sizeof(header) < header[0] || checksum(begin, header[0]) != header[1]) return false;
+
+    body = RecordReader(begin, begin + header[0]);
+    type = (EventType)body.get<uint8_t>();
+    body.get<int64_t>();  // timestamp, only for auditing
+    if (!body.ok) return false;
+    pos += sizeof(header) + header[0];
+    return true;
+}
+
+// Write-ahead log kept as numbered generations, wal.<generation>, with a new
+// one started at every snapshot. Older generations are never deleted so the
+// log doubles as the audit trail. append only copies into a buffer; the
+// first caller to waitDurable writes and fdatasyncs everything buffered so
+// far on behalf of every other waiter (group commit).
+class EventLog {
+private:
+    string directory;
+    uint64_t generation;
+    int fd = -1;
+    string pending;
+    uint64_t appended = 0;
+    uint64_t durable = 0;
+    bool flushing = false;
+    bool failed = false;
+    mutex mtx;
+    condition_variable flushed;
+
+public:
+    static string path(const string& directory, uint64_t generation) {
+        char name[32];
+        snprintf(name, sizeof(name), "wal.%020llu", (unsigned long long)generation);
+        return directory + "/" + name;
+    }
+
+    EventLog(const string& directory, uint64_t generation) : directory(directory), generation(generation) {}
+
+    ~EventLog() {
+        flush();
+        if (fd >= 0) ::close(fd);
+    }
+
+    EventLog(const EventLog&) = delete;
+    EventLog& operator=(const EventLog&) = delete;
+
+    bool open() {
+        fd = ::open(path(directory, generation).c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        return fd >= 0;
+    }
+
+    // Returns a sequence number to pass to waitDurable.
+    uint64_t append(const string& records) {
         lock_guard<mutex> lock(mtx);
-        bool canBlock = true;
+        pending += records;
+        return ++appended;
+    }
+
+    bool waitDurable(uint64_t sequence) {
+        unique_lock<mutex> lock(mtx);
+        while (durable < sequence && !failed) {
+            if (flushing) {
+                flushed.wait(lock);
+                continue;
+            }
+            flushing = true;
+            string batch;
+            batch.swap(pending);
+            uint64_t batchEnd = appended;
+            lock.unlock();
+            bool ok = writeAll(fd, batch.data(), batch.size()) && ::fdatasync(fd) == 0;
+            lock.lock();
+            flushing = false;
+            if (ok) {
+                durable = batchEnd;
+            } else {
+                failed = true;
+                cerr << "EventLog: failed to write " << path(directory, generation) << endl;
+            }
+            flushed.notify_all();
+        }
+        return !failed;
+    }
+
+    bool flush() {
+        uint64_t sequence;
+        {
+            lock_guard<mutex> lock(mtx);
+            sequence = appended;
+        }
+        return waitDurable(sequence);
+    }
+
+    // Seals the current generation and opens the next one. The caller must
+    // keep appends out for the duration.
+    bool rotate(uint64_t& nextGeneration) {
+        if (!flush()) return false;
+        unique_lock<mutex> lock(mtx);
+        flushed.wait(lock, [&] { return !flushing; });
+        ::close(fd);
+        generation++;
+        nextGeneration = generation;
+        fd = ::open(path(directory, generation).c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        return fd >= 0;
+    }
+};
+
+// Splits order lines across warehouses so the order ships from as few of
+// them as possible. Exact minimisation is set cover, so this is the greedy
+// approximation: each round takes the warehouse that completes the most
+// still-open lines, ties going to the one supplying more units, and draws
+// what it can from it. A round costs warehouses x lines over a dense
+// matrix, a few microseconds for 50 lines across 100 warehouses.
+class AllocationEngine {
+public:
+    // stock[l] is what each warehouse holds of products[l] and wanted[l]
+    // the units asked for. Returns allocations grouped by warehouse and
+    // leaves in wanted whatever no warehouse could cover.
+    static vector<Allocation> allocate(const vector<ProductHandle>& products,
+                                       const vector<const vector<WarehouseStock>*>& stock, vector<int>& wanted) {
+        // Only warehouses holding any of the order's products take part.
+        vector<WarehouseId> warehouses;
+        for (const auto* list : stock) {
+            for (const auto& entry : *list) {
+                if (entry.available > 0) warehouses.push_back(entry.warehouse);
+            }
+        }
+        sort(warehouses.begin(), warehouses.end());
+        warehouses.erase(unique(warehouses.begin(), warehouses.end()), warehouses.end());
+
+        size_t lines = products.size();
+        vector<int> supply(warehouses.size() * lines, 0);
+        for (size_t l = 0; l < lines; l++) {
+            for (const auto& entry : *stock[l]) {
+                if (entry.available <= 0) continue;
+                size_t w = lower_bound(warehouses.begin(), warehouses.end(), entry.warehouse) - warehouses.begin();
+                supply[w * lines + l] = entry.available;
+            }
+        }
+
+        vector<Allocation> allocations;
+        vector<bool> used(warehouses.size(), false);
+        size_t open = count_if(wanted.begin(), wanted.end(), [](int quantity) { return quantity > 0; });
+        while (open > 0) {
+            size_t best = warehouses.size();
+            size_t bestCompleted = 0;
+            long bestUnits = 0;
+            for (size_t w = 0; w < warehouses.size(); w++) {
+                if (used[w]) continue;
+                size_t completed = 0;
+                long units = 0;
+                for (size_t l = 0; l < lines; l++) {
+                    if (wanted[l] == 0) continue;
+                    int held = supply[w * lines + l];
+                    if (held >= wanted[l]) completed++;
+                    units += min(held, wanted[l]);
+                }
+                if (units > 0 && (completed > bestCompleted || (completed == bestCompleted && units > bestUnits))) {
+                    best = w;
+                    bestCompleted = completed;
+                    bestUnits = units;
+                }
+            }
+            if (best == warehouses.size()) break;
+
+            used[best] = true;
+            for (size_t l = 0; l < lines; l++) {
+                int take = min(supply[best * lines + l], wanted[l]);
+                if (take == 0) continue;
+                allocations.push_back({products[l], warehouses[best], take});
+                wanted[l] -= take;
+                if (wanted[l] == 0) open--;
+            }
+        }
+        return allocations;
+    }
+};
+
+// Array indexed by product handle that grows in segments of doubling size
+// and never moves an element once allocated, so a reader holding a
+// published handle can index it without a lock. Segment k holds
+// BASE << k elements; 23 of them cover every handle. Growth must be
+// serialised by the caller and done before the handle is published.
+template <typename T>
+class SegmentedArray {
+private:
+    static constexpr unsigned BASE_BITS = 10;
+    static constexpr unsigned SEGMENTS = 33 - BASE_BITS;
+
+    array<atomic<T*>, SEGMENTS> segments{};
+
+    static unsigned locate(size_t index, size_t& offset) {
+        size_t biased = index + ((size_t)1 << BASE_BITS);
+        unsigned bit = 63 - __builtin_clzll(biased);
+        offset = biased - ((size_t)1 << bit);
+        return bit - BASE_BITS;
+    }
+
+public:
+    SegmentedArray() = default;
+
+    ~SegmentedArray() {
+        for (auto& segment : segments) delete[] segment.load();
+    }
+
+    SegmentedArray(const SegmentedArray&) = delete;
+    SegmentedArray& operator=(const SegmentedArray&) = delete;
+
+    void grow(size_t index) {
+        size_t offset;
+        unsigned segment = locate(index, offset);
+        if (!segments[segment].load(memory_order_relaxed)) {
+            segments[segment].store(new T[(size_t)1 << (BASE_BITS + segment)](), memory_order_release);
+        }
+    }
+
+    T& operator[](size_t index) {
+        size_t offset;
+        unsigned segment = locate(index, offset);
+        return segments[segment].load(memory_order_acquire)[offset];
+    }
+};
+
+class InventoryManager {
+private:
+    static constexpr size_t LOCK_STRIPES = 64;
+    static constexpr size_t ORDER_SHARDS = 16;
+
+    struct OrderShard {
+        mutex mtx;
+        unordered_map<string, Order> orders;
+    };
+
+    // Counters are kept as structure-of-arrays indexed by handle, so the
+    // lines of an order are checked against contiguous memory. The arrays
+    // grow with the catalogue but never move, which lets readers load them
+    // without any lock; every write happens under the product's stripe.
+    // Products are never removed. available is the total over all
+    // warehouses; the per-warehouse split, sorted by warehouse, sits in
+    // stockByWarehouse under the same stripe.
+    SegmentedArray<atomic<int>> available;
+    SegmentedArray<atomic<int>> blocked;
+    SegmentedArray<atomic<int>> sold;
+    SegmentedArray<vector<WarehouseStock>> stockByWarehouse;
+    atomic<ProductHandle> productCount{0};
+
+    // Low-stock thresholds and whether each product is currently below its
+    // one, guarded by the product's stripe. Only products whose count just
+    // changed are checked, so alerting never scans the catalogue.
+    SegmentedArray<int> thresholds;
+    SegmentedArray<bool> lowStock;
+    shared_ptr<AlertSink> alertSink;
+    atomic<uint64_t> alertSequence{0};
+
+    // Cold data, guarded by the catalogue lock: the id -> handle map and
+    // the ids and names indexed by handle.
+    unordered_map<string, ProductHandle> handles;
+    vector<string> productIds;
+    vector<string> names;
+    vector<string> warehouseNames;
+    shared_mutex catalogueMtx;
+    atomic<WarehouseId> warehouseCount{1};
+    atomic<bool> allowPartial{false};
 
-        for (size_t i = 0; i < productIds.size(); i++) {
-            if (inventory[productIds[i]].inventoryCount < quantityOrdered[i]) {
-                canBlock = false;
+    // Product counts are guarded by one of LOCK_STRIPES mutexes picked by
+    // the product handle; orders live in ORDER_SHARDS shards keyed by order
+    // id. Lock order is always order shard, then stripes ascending, then
+    // the catalogue lock.
+    array<mutex, LOCK_STRIPES> stripes;
+    array<OrderShard, ORDER_SHARDS> orderShards;
+    bool verbose;
+
+    // Reservation deadlines, earliest first. One thread sleeps until the
+    // next deadline and releases the order if it is still unconfirmed, so
+    // thread count does not grow with the number of orders in flight. Each
+    // entry carries the order's expiresAt: an entry left behind by an
+    // order that is gone must not release a new order reusing its id.
+    typedef tuple<time_point<steady_clock>, string, int64_t> Expiry;
+    static constexpr int64_t ANY_DEADLINE = -1;
+    priority_queue<Expiry, vector<Expiry>, greater<Expiry>> expiries;
+    mutex expiryMtx;
+    condition_variable expiryCv;
+    bool stopping = false;
+    milliseconds reservationTtl;
+    thread expiryThread;
+
+    // Off until enablePersistence. Each mutation is appended to the log while
+    // its locks are still held, so log order matches apply order for any two
+    // changes that touch the same product or order; the caller then waits
+    // for the group commit after releasing them.
+    unique_ptr<EventLog> log;
+    string persistenceDirectory;
+    mutex snapshotMtx;
+    condition_variable snapshotCv;
+    thread snapshotThread;
+
+    static size_t stripeFor(ProductHandle handle) {
+        return handle % LOCK_STRIPES;
+    }
+
+    OrderShard& shardFor(const string& orderId) {
+        return orderShards[hash<string>{}(orderId) % ORDER_SHARDS];
+    }
+
+    // Locks every stripe the products map to, in ascending order, so
+    // multi-product orders can never deadlock against each other.
+    vector<unique_lock<mutex>> lockStripes(const vector<ProductHandle>& products) {
+        vector<size_t> indexes;
+        for (ProductHandle handle : products) {
+            indexes.push_back(stripeFor(handle));
+        }
+        sort(indexes.begin(), indexes.end());
+        indexes.erase(unique(indexes.begin(), indexes.end()), indexes.end());
+
+        vector<unique_lock<mutex>> locks;
+        for (size_t index : indexes) {
+            locks.emplace_back(stripes[index]);
+        }
+        return locks;
+    }
+
+    // Caller must hold catalogueMtx exclusively. Returns the existing handle
+    // or a new one, or INVALID_PRODUCT once every handle is taken. A new
+    // handle is not published to lock-free readers until the caller has
+    // set up its stock and calls publish.
+    ProductHandle intern(const string& productId) {
+        auto it = handles.find(productId);
+        if (it != handles.end()) return it->second;
+        ProductHandle handle = productIds.size();
+        if (handle == INVALID_PRODUCT) return INVALID_PRODUCT;
+        available.grow(handle);
+        blocked.grow(handle);
+        sold.grow(handle);
+        stockByWarehouse.grow(handle);
+        thresholds.grow(handle);
+        lowStock.grow(handle);
+        handles[productId] = handle;
+        productIds.push_back(productId);
+        names.emplace_back();
+        return handle;
+    }
+
+    void publish(ProductHandle handle) {
+        if (handle >= productCount.load(memory_order_relaxed)) productCount.store(handle + 1, memory_order_release);
+    }
+
+    // Caller must hold catalogueMtx. Returns false on the first unknown id.
+    bool resolveProducts(const vector<string>& ids, vector<ProductHandle>& products) {
+        products.clear();
+        for (const auto& productId : ids) {
+            auto it = handles.find(productId);
+            if (it == handles.end()) return false;
+            products.push_back(it->second);
+        }
+        return true;
+    }
+
+    // Caller must hold the product's stripe and have just changed its count.
+    // Queues an alert if that moved it across its threshold.
+    void checkThreshold(ProductHandle handle, vector<StockAlert>& alerts) {
+        int count = available[handle].load(memory_order_relaxed);
+        bool low = count < thresholds[handle];
+        if (low == lowStock[handle]) return;
+        lowStock[handle] = low;
+        if (alertSink) alerts.push_back({string(), handle, count, thresholds[handle], low, ++alertSequence});
+    }
+
+    // Called once the caller's locks are released.
+    void deliverAlerts(vector<StockAlert>& alerts) {
+        if (alerts.empty()) return;
+        {
+            shared_lock<shared_mutex> lock(catalogueMtx);
+            for (auto& alert : alerts) alert.productId = productIds[alert.handle];
+        }
+        for (const auto& alert : alerts) alertSink->onAlert(alert);
+    }
+
+    // Caller must hold the product's stripe. Adds an empty entry if the
+    // product has never been stocked in that warehouse.
+    int& warehouseStock(ProductHandle handle, WarehouseId warehouse) {
+        auto& list = stockByWarehouse[handle];
+        auto it = lower_bound(list.begin(), list.end(), warehouse,
+                              [](const WarehouseStock& entry, WarehouseId id) { return entry.warehouse < id; });
+        if (it == list.end() || it->warehouse != warehouse) it = list.insert(it, {warehouse, 0});
+        return it->available;
+    }
+
+    // Caller must hold the product's stripe. Applies a per-order allocation
+    // in either direction: sign -1 reserves it, +1 gives it back.
+    void applyAllocations(const vector<Allocation>& allocations, int sign) {
+        for (const auto& allocation : allocations) {
+            warehouseStock(allocation.product, allocation.warehouse) += sign * allocation.quantity;
+            available[allocation.product] += sign * allocation.quantity;
+            blocked[allocation.product] -= sign * allocation.quantity;
+        }
+    }
+
+    // Rebuilds the per-product totals of an order from its allocations.
+    static void summarize(Order& order) {
+        order.products.clear();
+        order.quantities.clear();
+        for (const auto& allocation : order.allocations) {
+            auto it = find(order.products.begin(), order.products.end(), allocation.product);
+            if (it == order.products.end()) {
+                order.products.push_back(allocation.product);
+                order.quantities.push_back(allocation.quantity);
+            } else {
+                order.quantities[it - order.products.begin()] += allocation.quantity;
+            }
+        }
+    }
+
+    static bool succeeded(OrderResult result) {
+        return result == OrderResult::RESERVED || result == OrderResult::PARTIALLY_RESERVED;
+    }
+
+    // Allocates the order across warehouses and blocks it: every line in
+    // full, or with partial fulfillment on, whatever is in stock as long as
+    // that is something. The expiry is left to the caller so batches can
+    // schedule theirs under one lock.
+    OrderResult reserveOrder(const string& orderId, const vector<ProductHandle>& products,
+                             const vector<int>& quantities, time_point<steady_clock> now, int64_t expiresAt,
+                             uint64_t& sequence, vector<StockAlert>& alerts) {
+        OrderShard& shard = shardFor(orderId);
+        lock_guard<mutex> orderLock(shard.mtx);
+        if (shard.orders.find(orderId) != shard.orders.end()) return OrderResult::DUPLICATE_ORDER;
+
+        // A product listed twice needs the sum of both lines, which must
+        // still fit in an int.
+        vector<ProductHandle> distinct;
+        vector<int> wanted;
+        for (size_t i = 0; i < products.size(); i++) {
+            auto it = find(distinct.begin(), distinct.end(), products[i]);
+            if (it == distinct.end()) {
+                distinct.push_back(products[i]);
+                wanted.push_back(quantities[i]);
+            } else {
+                int& total = wanted[it - distinct.begin()];
+                if ((int64_t)total + quantities[i] > INT_MAX) return OrderResult::INVALID;
+                total += quantities[i];
+            }
+        }
+
+        auto locks = lockStripes(distinct);
+        vector<const vector<WarehouseStock>*> stock;
+        for (ProductHandle handle : distinct) {
+            stock.push_back(&stockByWarehouse[handle]);
+        }
+        vector<Allocation> allocations = AllocationEngine::allocate(distinct, stock, wanted);
+        bool complete = all_of(wanted.begin(), wanted.end(), [](int missing) { return missing == 0; });
+        if (allocations.empty() || (!complete && !allowPartial.load(memory_order_relaxed))) {
+            return OrderResult::INSUFFICIENT_STOCK;
+        }
+
+        Order& order = shard.orders[orderId];
+        order.allocations = move(allocations);
+        order.orderTime = now;
+        order.confirmed = false;
+        order.expiresAt = expiresAt;
+        summarize(order);
+        applyAllocations(order.allocations, -1);
+        for (ProductHandle handle : order.products) {
+            checkThreshold(handle, alerts);
+        }
+        if (log) {
+            shared_lock<shared_mutex> catalogueLock(catalogueMtx);
+            sequence = log->append(encodeOrder(EventType::RESERVED, orderId, order));
+        }
+        return complete ? OrderResult::RESERVED : OrderResult::PARTIALLY_RESERVED;
+    }
+
+    static bool validOrder(const vector<ProductHandle>& products, const vector<int>& quantities) {
+        if (products.empty() || products.size() != quantities.size()) return false;
+        for (int quantity : quantities) {
+            if (quantity <= 0) return false;
+        }
+        return true;
+    }
+
+    // Same layout for a new reservation and for an order in a snapshot.
+    // Records carry product ids, not handles, so they outlive the process.
+    // Caller must hold catalogueMtx.
+    string encodeOrder(EventType type, const string& orderId, const Order& order) {
+        string record;
+        RecordWriter writer(record, type);
+        writer.put(orderId).put((uint8_t)order.confirmed).put(order.expiresAt).put((uint32_t)order.allocations.size());
+        for (const auto& allocation : order.allocations) {
+            writer.put(productIds[allocation.product]).put(allocation.warehouse).put((int32_t)allocation.quantity);
+        }
+        writer.done();
+        return record;
+    }
+
+    static string orderRecord(EventType type, const string& orderId) {
+        string record;
+        RecordWriter(record, type).put(orderId).done();
+        return record;
+    }
+
+    // False once the log has failed: the change is in memory only.
+    bool awaitDurable(uint64_t sequence) {
+        return !log || sequence == 0 || log->waitDurable(sequence);
+    }
+
+    // Applies one snapshot or log record during recovery, when nothing else
+    // touches the state yet, so no locks are taken.
+    bool replayRecord(EventType type, RecordReader& in) {
+        switch (type) {
+        case EventType::WAREHOUSE: {
+            string name = in.getString();
+            if (!in.ok) return false;
+            warehouseNames.push_back(name);
+            warehouseCount.store(warehouseNames.size());
+            return true;
+        }
+        case EventType::PRODUCT: {
+            string productId = in.getString();
+            string name = in.getString();
+            int count = in.get<int32_t>();
+            ProductHandle handle = in.ok ? intern(productId) : INVALID_PRODUCT;
+            if (handle == INVALID_PRODUCT) return false;
+            names[handle] = name;
+            int& stock = warehouseStock(handle, DEFAULT_WAREHOUSE);
+            available[handle] += count - stock;
+            stock = count;
+            publish(handle);
+            return true;
+        }
+        case EventType::SNAPSHOT_PRODUCT: {
+            string productId = in.getString();
+            string name = in.getString();
+            int blockedCount = in.get<int32_t>();
+            int soldCount = in.get<int32_t>();
+            uint32_t entries = in.get<uint32_t>();
+            ProductHandle handle = in.ok ? intern(productId) : INVALID_PRODUCT;
+            if (handle == INVALID_PRODUCT) return false;
+            names[handle] = name;
+            blocked[handle] = blockedCount;
+            sold[handle] = soldCount;
+            stockByWarehouse[handle].clear();
+            int total = 0;
+            for (uint32_t i = 0; i < entries && in.ok; i++) {
+                WarehouseId warehouse = in.get<WarehouseId>();
+                int count = in.get<int32_t>();
+                stockByWarehouse[handle].push_back({warehouse, count});
+                total += count;
+            }
+            available[handle] = total;
+            publish(handle);
+            return in.ok;
+        }
+        case EventType::STOCK_DELTA: {
+            string productId = in.getString();
+            int delta = in.get<int32_t>();
+            WarehouseId warehouse = in.get<WarehouseId>();
+            auto it = handles.find(productId);
+            if (!in.ok || it == handles.end() || warehouse >= warehouseNames.size()) return false;
+            warehouseStock(it->second, warehouse) += delta;
+            available[it->second] += delta;
+            return true;
+        }
+        case EventType::RESERVED:
+        case EventType::SNAPSHOT_ORDER: {
+            string orderId = in.getString();
+            Order order;
+            order.confirmed = in.get<uint8_t>() != 0;
+            order.expiresAt = in.get<int64_t>();
+            order.orderTime = steady_clock::now();
+            uint32_t entries = in.get<uint32_t>();
+            for (uint32_t i = 0; i < entries && in.ok; i++) {
+                auto it = handles.find(in.getString());
+                WarehouseId warehouse = in.get<WarehouseId>();
+                int quantity = in.get<int32_t>();
+                if (it == handles.end()) return false;
+                order.allocations.push_back({it->second, warehouse, quantity});
+            }
+            if (!in.ok) return false;
+            summarize(order);
+            if (type == EventType::RESERVED) applyAllocations(order.allocations, -1);
+            shardFor(orderId).orders[orderId] = move(order);
+            return true;
+        }
+        case EventType::CONFIRMED:
+        case EventType::RELEASED: {
+            string orderId = in.getString();
+            auto& orders = shardFor(orderId).orders;
+            auto it = orders.find(orderId);
+            if (!in.ok || it == orders.end()) return false;
+            Order& order = it->second;
+            if (type == EventType::CONFIRMED) {
+                for (size_t i = 0; i < order.products.size(); i++) {
+                    blocked[order.products[i]] -= order.quantities[i];
+                    sold[order.products[i]] += order.quantities[i];
+                }
+                order.confirmed = true;
+            } else {
+                applyAllocations(order.allocations, +1);
+                orders.erase(it);
+            }
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+
+    // Replays records from pos until the data ends or a record is torn or
+    // corrupt, leaving pos just past the last intact one. Returns false if
+    // an intact record could not be applied, which means the files do not
+    // describe a consistent history and must not be truncated.
+    bool replayFile(const string& data, size_t& pos) {
+        EventType type;
+        RecordReader in;
+        while (nextRecord(data, pos, type, in)) {
+            if (!replayRecord(type, in)) return false;
+        }
+        return true;
+    }
+
+    void runSnapshots(milliseconds interval) {
+        unique_lock<mutex> lock(expiryMtx);
+        while (!snapshotCv.wait_for(lock, interval, [&] { return stopping; })) {
+            lock.unlock();
+            snapshot();
+            lock.lock();
+        }
+    }
+
+    void scheduleExpiry(const string& orderId, time_point<steady_clock> deadline, int64_t expiresAt) {
+        lock_guard<mutex> lock(expiryMtx);
+        bool earliest = expiries.empty() || deadline < get<0>(expiries.top());
+        expiries.push({deadline, orderId, expiresAt});
+        if (earliest) expiryCv.notify_one();
+    }
+
+    void runExpiry() {
+        unique_lock<mutex> lock(expiryMtx);
+        while (!stopping) {
+            if (expiries.empty()) {
+                expiryCv.wait(lock);
+                continue;
+            }
+            Expiry next = expiries.top();
+            if (steady_clock::now() < get<0>(next)) {
+                expiryCv.wait_until(lock, get<0>(next));
+                continue;
+            }
+            expiries.pop();
+            lock.unlock();
+            releaseOrder(get<1>(next), get<2>(next));
+            lock.lock();
+        }
+    }
+
+public:
+    InventoryManager(milliseconds reservationTtl = minutes(5), bool verbose = true)
+        : verbose(verbose),
+          reservationTtl(reservationTtl) {
+        warehouseNames.push_back("default");
+        expiryThread = thread(&InventoryManager::runExpiry, this);
+    }
+
+    // Pending reservations are left blocked; nothing is released on shutdown.
+    ~InventoryManager() {
+        {
+            lock_guard<mutex> lock(expiryMtx);
+            stopping = true;
+        }
+        expiryCv.notify_one();
+        snapshotCv.notify_one();
+        expiryThread.join();
+        if (snapshotThread.joinable()) snapshotThread.join();
+    }
+
+    InventoryManager(const InventoryManager&) = delete;
+    InventoryManager& operator=(const InventoryManager&) = delete;
+
+    // Creates the product or resets its stock in the default warehouse.
+    // Returns its handle, or INVALID_PRODUCT when the catalogue is full or
+    // the change could not be made durable.
+    ProductHandle createProduct(string productId, string name, int count) {
+        string record;
+        if (log) RecordWriter(record, EventType::PRODUCT).put(productId).put(name).put((int32_t)count).done();
+        ProductHandle handle;
+        uint64_t sequence = 0;
+        bool created;
+        {
+            unique_lock<shared_mutex> lock(catalogueMtx);
+            created = handles.find(productId) == handles.end();
+            handle = intern(productId);
+            if (handle == INVALID_PRODUCT) {
+                if (verbose) cout << "Catalogue full, product " << productId << " not created." << endl;
+                return INVALID_PRODUCT;
+            }
+            names[handle] = name;
+            if (created) {
+                // Nobody can reach the handle before the catalogue lock is
+                // released and it is published, so its stock is set up and
+                // its record logged here, ahead of any delta or order on it.
+                // It has no threshold yet, so there is nothing to alert on.
+                warehouseStock(handle, DEFAULT_WAREHOUSE) = count;
+                available[handle] = count;
+                if (log) sequence = log->append(record);
+                publish(handle);
+            }
+        }
+        vector<StockAlert> alerts;
+        if (!created) {
+            lock_guard<mutex> lock(stripes[stripeFor(handle)]);
+            int& stock = warehouseStock(handle, DEFAULT_WAREHOUSE);
+            available[handle] += count - stock;
+            stock = count;
+            checkThreshold(handle, alerts);
+            if (log) sequence = log->append(record);
+        }
+        bool durable = awaitDurable(sequence);
+        deliverAlerts(alerts);
+        if (!durable) return INVALID_PRODUCT;
+        if (verbose) cout << "Product created: " << productId << " -> (" << name << ", " << count << ")" << endl;
+        return handle;
+    }
+
+    // Every product's counters as of one instant: all stripes are held while
+    // they are read, so no reservation is caught half applied.
+    vector<StockLevels> auditStock() {
+        vector<unique_lock<mutex>> locks;
+        locks.reserve(LOCK_STRIPES);
+        for (auto& stripe : stripes) {
+            locks.emplace_back(stripe);
+        }
+        ProductHandle count = productCount.load(memory_order_acquire);
+        vector<StockLevels> levels(count);
+        for (ProductHandle handle = 0; handle < count; handle++) {
+            int warehoused = 0;
+            for (const auto& entry : stockByWarehouse[handle]) {
+                warehoused += entry.available;
+            }
+            levels[handle] = {available[handle].load(memory_order_relaxed), blocked[handle].load(memory_order_relaxed),
+                              sold[handle].load(memory_order_relaxed), warehoused};
+        }
+        return levels;
+    }
+
+    // Warehouse 0 is the default one createProduct stocks. Returns the new
+    // warehouse's id, or INVALID_WAREHOUSE if it could not be made durable.
+    WarehouseId addWarehouse(const string& name) {
+        WarehouseId warehouse;
+        uint64_t sequence = 0;
+        {
+            unique_lock<shared_mutex> lock(catalogueMtx);
+            warehouse = warehouseNames.size();
+            warehouseNames.push_back(name);
+            warehouseCount.store(warehouse + 1, memory_order_release);
+            if (log) {
+                string record;
+                RecordWriter(record, EventType::WAREHOUSE).put(name).done();
+                sequence = log->append(record);
+            }
+        }
+        return awaitDurable(sequence) ? warehouse : INVALID_WAREHOUSE;
+    }
+
+    // When on, an order that cannot be filled completely still reserves
+    // whatever is in stock; its lines then hold the reserved quantities.
+    void setPartialFulfillment(bool allow) {
+        allowPartial = allow;
+    }
+
+    // Where low-stock alerts go; wrap it in a CoalescingAlertSink to damp
+    // flapping products. Set before the manager is shared between threads.
+    void setAlertSink(shared_ptr<AlertSink> sink) {
+        alertSink = move(sink);
+    }
+
+    // Alerts fire when the available count drops below threshold and again
+    // when it is back at or above it; 0 turns alerting off for the product.
+    // Thresholds are configuration and are not written to the log.
+    bool setLowStockThreshold(const string& productId, int threshold) {
+        ProductHandle handle = getHandle(productId);
+        if (handle == INVALID_PRODUCT) return false;
+        vector<StockAlert> alerts;
+        {
+            lock_guard<mutex> lock(stripes[stripeFor(handle)]);
+            thresholds[handle] = threshold;
+            checkThreshold(handle, alerts);
+        }
+        deliverAlerts(alerts);
+        return true;
+    }
+
+    ProductHandle getHandle(const string& productId) {
+        shared_lock<shared_mutex> lock(catalogueMtx);
+        auto it = handles.find(productId);
+        return it == handles.end() ? INVALID_PRODUCT : it->second;
+    }
+
+    // Lock-free: a single atomic load from the counter array.
+    int getInventory(ProductHandle handle) {
+        if (handle >= productCount.load(memory_order_acquire)) return -1;
+        return available[handle].load();
+    }
+
+    int getInventory(string productId) {
+        return getInventory(getHandle(productId));
+    }
+
+    // Available units of the product in one warehouse.
+    int getInventory(const string& productId, WarehouseId warehouse) {
+        ProductHandle handle = getHandle(productId);
+        if (handle == INVALID_PRODUCT || warehouse >= warehouseCount.load(memory_order_acquire)) return -1;
+        lock_guard<mutex> lock(stripes[stripeFor(handle)]);
+        return warehouseStock(handle, warehouse);
+    }
+
+    // The order's reservation split into shipments: allocations grouped
+    // by warehouse. Empty if the order is unknown.
+    vector<Allocation> getAllocations(const string& orderId) {
+        OrderShard& shard = shardFor(orderId);
+        lock_guard<mutex> orderLock(shard.mtx);
+        auto it = shard.orders.find(orderId);
+        return it == shard.orders.end() ? vector<Allocation>() : it->second.allocations;
+    }
+
+    bool createOrder(vector<string> productIds, vector<int> quantityOrdered, string orderId) {
+        vector<ProductHandle> products;
+        bool known;
+        {
+            shared_lock<shared_mutex> lock(catalogueMtx);
+            known = resolveProducts(productIds, products);
+        }
+        if (!known) {
+            if (verbose) cout << "Unknown product in order " << orderId << "." << endl;
+            return false;
+        }
+        return createOrderByHandle(products, quantityOrdered, orderId);
+    }
+
+    // Same as createOrder with handles from createProduct or getHandle,
+    // which skips every id lookup.
+    bool createOrderByHandle(const vector<ProductHandle>& products, const vector<int>& quantityOrdered, const string& orderId) {
+        OrderResult result = OrderResult::INVALID;
+        if (validOrder(products, quantityOrdered)) {
+            ProductHandle count = productCount.load(memory_order_acquire);
+            bool known = all_of(products.begin(), products.end(), [&](ProductHandle handle) { return handle < count; });
+            auto now = steady_clock::now();
+            int64_t expiresAt = epochMillis() + reservationTtl.count();
+            uint64_t sequence = 0;
+            vector<StockAlert> alerts;
+            result = known ? reserveOrder(orderId, products, quantityOrdered, now, expiresAt, sequence, alerts)
+                           : OrderResult::UNKNOWN_PRODUCT;
+            bool durable = awaitDurable(sequence);
+            deliverAlerts(alerts);
+            // Even an undurable reservation holds stock in memory until it expires.
+            if (succeeded(result)) scheduleExpiry(orderId, now + reservationTtl, expiresAt);
+            if (!durable) result = OrderResult::NOT_DURABLE;
+        }
+
+        if (verbose) {
+            switch (result) {
+            case OrderResult::RESERVED:
+                cout << "Order " << orderId << " created and inventory blocked." << endl;
+                break;
+            case OrderResult::PARTIALLY_RESERVED:
+                cout << "Order " << orderId << " created with the inventory available blocked." << endl;
+                break;
+            case OrderResult::UNKNOWN_PRODUCT:
+                cout << "Unknown product in order " << orderId << "." << endl;
+                break;
+            case OrderResult::DUPLICATE_ORDER:
+                cout << "Order " << orderId << " already exists." << endl;
+                break;
+            case OrderResult::INSUFFICIENT_STOCK:
+                cout << "Insufficient inventory to create order " << orderId << "." << endl;
+                break;
+            case OrderResult::INVALID:
+                cout << "Order " << orderId << " is malformed." << endl;
+                break;
+            case OrderResult::NOT_DURABLE:
+                cout << "Order " << orderId << " could not be logged." << endl;
                 break;
             }
         }
+        return succeeded(result);
+    }
 
-        if (canBlock) {
-            for (size_t i = 0; i < productIds.size(); i++) {
-                inventory[productIds[i]].inventoryCount -= quantityOrdered[i];
-                blockedInventory[productIds[i]] += quantityOrdered[i];
+    // Applies each delta on its own: an unknown product, a ship-out larger
+    // than available stock or a delivery that would overflow the stock count
+    // (INVALID) fails that item only. Products are resolved under
+    // one catalogue lock and each stripe is taken once for all its deltas,
+    // which are applied in input order. Never prints.
+    vector<DeltaResult> applyStockDeltas(const vector<StockDelta>& deltas) {
+        vector<DeltaResult> results(deltas.size(), DeltaResult::UNKNOWN_PRODUCT);
+        vector<ProductHandle> products(deltas.size(), INVALID_PRODUCT);
+        vector<pair<size_t, size_t>> byStripe;
+        WarehouseId warehouses = warehouseCount.load(memory_order_acquire);
+        {
+            shared_lock<shared_mutex> lock(catalogueMtx);
+            for (size_t i = 0; i < deltas.size(); i++) {
+                auto it = handles.find(deltas[i].productId);
+                if (it == handles.end()) continue;
+                if (deltas[i].warehouse >= warehouses) {
+                    results[i] = DeltaResult::UNKNOWN_WAREHOUSE;
+                    continue;
+                }
+                products[i] = it->second;
+                byStripe.push_back({stripeFor(it->second), i});
             }
-            orders[orderId] = {productIds, quantityOrdered, steady_clock::now(), false};
-            cout << "Order " << orderId << " created and inventory blocked." << endl;
+        }
+        sort(byStripe.begin(), byStripe.end());
 
-            thread(&InventoryManager::releaseBlockedInventory, this, orderId).detach();
-        } else {
-            cout << "Insufficient inventory to create order " << orderId << "." << endl;
+        uint64_t sequence = 0;
+        string records;
+        vector<StockAlert> alerts;
+        for (size_t g = 0; g < byStripe.size();) {
+            size_t stripe = byStripe[g].first;
+            lock_guard<mutex> lock(stripes[stripe]);
+            records.clear();
+            for (; g < byStripe.size() && byStripe[g].first == stripe; g++) {
+                size_t i = byStripe[g].second;
+                int& stock = warehouseStock(products[i], deltas[i].warehouse);
+                int64_t newStock = (int64_t)stock + deltas[i].delta;
+                if (newStock < 0) {
+                    results[i] = DeltaResult::INSUFFICIENT_STOCK;
+                } else if (newStock > INT_MAX || (int64_t)available[products[i]].load() + deltas[i].delta > INT_MAX) {
+                    results[i] = DeltaResult::INVALID;
+                } else {
+                    stock += deltas[i].delta;
+                    available[products[i]] += deltas[i].delta;
+                    results[i] = DeltaResult::APPLIED;
+                    checkThreshold(products[i], alerts);
+                    if (log) {
+                        RecordWriter(records, EventType::STOCK_DELTA)
+                            .put(deltas[i].productId)
+                            .put((int32_t)deltas[i].delta)
+                            .put(deltas[i].warehouse)
+                            .done();
+                    }
+                }
+            }
+            if (!records.empty()) sequence = log->append(records);
+        }
+        if (!awaitDurable(sequence)) {
+            replace(results.begin(), results.end(), DeltaResult::APPLIED, DeltaResult::NOT_DURABLE);
         }
+        deliverAlerts(alerts);
+        return results;
     }
 
-    void confirmOrder(string orderId) {
-        lock_guard<mutex> lock(mtx);
-        if (orders.find(orderId) != orders.end() && !orders[orderId].confirmed) {
-            for (size_t i = 0; i < orders[orderId].productIds.size(); i++) {
-                blockedInventory[orders[orderId].productIds[i]] -= orders[orderId].quantities[i];
+    // Reserves each order all-or-nothing, independently of the others in the
+    // batch. Product lookups share one catalogue lock and the reservation
+    // deadlines are queued together. Never prints.
+    vector<OrderResult> createOrders(const vector<OrderRequest>& requests) {
+        vector<OrderResult> results(requests.size(), OrderResult::INVALID);
+        vector<vector<ProductHandle>> products(requests.size());
+        {
+            shared_lock<shared_mutex> lock(catalogueMtx);
+            for (size_t i = 0; i < requests.size(); i++) {
+                const OrderRequest& request = requests[i];
+                if (!resolveProducts(request.productIds, products[i])) {
+                    results[i] = OrderResult::UNKNOWN_PRODUCT;
+                } else if (validOrder(products[i], request.quantities)) {
+                    results[i] = OrderResult::RESERVED;
+                }
+            }
+        }
+
+        auto now = steady_clock::now();
+        int64_t expiresAt = epochMillis() + reservationTtl.count();
+        uint64_t sequence = 0;
+        vector<string> reserved;
+        vector<StockAlert> alerts;
+        for (size_t i = 0; i < requests.size(); i++) {
+            if (results[i] != OrderResult::RESERVED) continue;
+            const OrderRequest& request = requests[i];
+            results[i] = reserveOrder(request.orderId, products[i], request.quantities, now, expiresAt, sequence,
+                                      alerts);
+            if (succeeded(results[i])) reserved.push_back(request.orderId);
+        }
+        if (!awaitDurable(sequence)) {
+            for (auto& result : results) {
+                if (succeeded(result)) result = OrderResult::NOT_DURABLE;
             }
-            orders[orderId].confirmed = true;
-            cout << "Order " << orderId << " confirmed and inventory permanently reduced." << endl;
-        } else {
-            cout << "Order " << orderId << " not found or already confirmed." << endl;
         }
+        deliverAlerts(alerts);
+
+        if (!reserved.empty()) {
+            lock_guard<mutex> lock(expiryMtx);
+            bool earliest = expiries.empty() || now + reservationTtl < get<0>(expiries.top());
+            for (auto& orderId : reserved) {
+                expiries.push({now + reservationTtl, move(orderId), expiresAt});
+            }
+            if (earliest) expiryCv.notify_one();
+        }
+        return results;
     }
 
-    void releaseBlockedInventory(string orderId) {
-        this_thread::sleep_for(minutes(5));
-        lock_guard<mutex> lock(mtx);
-        if (orders.find(orderId) != orders.end() && !orders[orderId].confirmed) {
-            for (size_t i = 0; i < orders[orderId].productIds.size(); i++) {
-                inventory[orders[orderId].productIds[i]].inventoryCount += orders[orderId].quantities[i];
-                blockedInventory[orders[orderId].productIds[i]] -= orders[orderId].quantities[i];
+    bool confirmOrder(string orderId) {
+        OrderShard& shard = shardFor(orderId);
+        unique_lock<mutex> orderLock(shard.mtx);
+        auto it = shard.orders.find(orderId);
+        if (it != shard.orders.end() && !it->second.confirmed) {
+            Order& order = it->second;
+            uint64_t sequence = 0;
+            {
+                auto locks = lockStripes(order.products);
+                for (size_t i = 0; i < order.products.size(); i++) {
+                    blocked[order.products[i]] -= order.quantities[i];
+                    sold[order.products[i]] += order.quantities[i];
+                }
+                order.confirmed = true;
+                if (log) sequence = log->append(orderRecord(EventType::CONFIRMED, orderId));
+            }
+            orderLock.unlock();
+            if (!awaitDurable(sequence)) return false;
+            if (verbose) cout << "Order " << orderId << " confirmed and inventory permanently reduced." << endl;
+            return true;
+        }
+        if (verbose) cout << "Order " << orderId << " not found or already confirmed." << endl;
+        return false;
+    }
+
+private:
+    // Releases the order if it is unconfirmed and, unless expiresAt is
+    // ANY_DEADLINE, still the reservation with that deadline.
+    bool releaseOrder(const string& orderId, int64_t expiresAt) {
+        OrderShard& shard = shardFor(orderId);
+        unique_lock<mutex> orderLock(shard.mtx);
+        auto it = shard.orders.find(orderId);
+        if (it != shard.orders.end() && !it->second.confirmed &&
+            (expiresAt == ANY_DEADLINE || it->second.expiresAt == expiresAt)) {
+            Order& order = it->second;
+            uint64_t sequence = 0;
+            vector<StockAlert> alerts;
+            {
+                auto locks = lockStripes(order.products);
+                applyAllocations(order.allocations, +1);
+                for (ProductHandle handle : order.products) {
+                    checkThreshold(handle, alerts);
+                }
+                if (log) sequence = log->append(orderRecord(EventType::RELEASED, orderId));
             }
-            orders.erase(orderId);
-            cout << "Order " << orderId << " was not confirmed in time. Inventory released back." << endl;
+            shard.orders.erase(it);
+            orderLock.unlock();
+            bool durable = awaitDurable(sequence);
+            deliverAlerts(alerts);
+            if (verbose) cout << "Order " << orderId << " was not confirmed in time. Inventory released back." << endl;
+            return durable;
         }
+        return false;
+    }
+
+public:
+    // Releases the order's reservation now, as its expiry would. Returns
+    // false if there was nothing to release or the release could not be
+    // made durable.
+    bool releaseBlockedInventory(string orderId) {
+        return releaseOrder(orderId, ANY_DEADLINE);
+    }
+
+    // Recovers state from <directory>: the latest snapshot, then every log
+    // generation written after it. A torn record at the end of the newest
+    // generation is cut off; any other damage, or a record that does not
+    // apply, fails recovery. From then on every mutation is logged and only
+    // returns once it is durable, and a snapshot is taken every
+    // snapshotInterval (zero disables them). Products created before this
+    // call are written out in a snapshot straight away.
+    bool enablePersistence(const string& directory, milliseconds snapshotInterval = minutes(1)) {
+        bool existingState = productCount.load() > 0 || warehouseNames.size() > 1;
+        error_code ec;
+        filesystem::create_directories(directory, ec);
+        if (ec) return false;
+
+        uint64_t generation = 1;
+        string snapshotPath = directory + "/snapshot";
+        if (filesystem::exists(snapshotPath)) {
+            string data;
+            size_t pos = 0;
+            EventType type;
+            RecordReader in;
+            if (!readFile(snapshotPath, data) || !nextRecord(data, pos, type, in) || type != EventType::SNAPSHOT_HEADER) {
+                return false;
+            }
+            generation = in.get<uint64_t>();
+            uint64_t products = in.get<uint64_t>();
+            handles.reserve(products);
+            productIds.reserve(products);
+            names.reserve(products);
+            if (!replayFile(data, pos) || pos != data.size()) return false;
+        }
+
+        vector<uint64_t> generations;
+        for (const auto& entry : filesystem::directory_iterator(directory, ec)) {
+            string name = entry.path().filename().string();
+            if (name.rfind("wal.", 0) != 0) continue;
+            uint64_t g = stoull(name.substr(4));
+            if (g >= generation) generations.push_back(g);
+        }
+        sort(generations.begin(), generations.end());
+        for (size_t i = 0; i < generations.size(); i++) {
+            string path = EventLog::path(directory, generations[i]);
+            string data;
+            if (!readFile(path, data)) return false;
+            size_t end = 0;
+            if (!replayFile(data, end)) return false;
+            if (end == data.size()) continue;
+            if (i + 1 < generations.size()) return false;
+            if (::truncate(path.c_str(), end) != 0) return false;
+        }
+        if (!generations.empty()) generation = generations.back();
+
+        log = make_unique<EventLog>(directory, generation);
+        if (!log->open()) return false;
+        persistenceDirectory = directory;
+        if (existingState && !snapshot()) return false;
+
+        // Deadlines are stored as wall-clock time; anything already overdue
+        // is released straight away by the expiry thread.
+        auto now = steady_clock::now();
+        int64_t wallNow = epochMillis();
+        vector<Expiry> pending;
+        for (auto& shard : orderShards) {
+            for (const auto& entry : shard.orders) {
+                if (entry.second.confirmed) continue;
+                pending.push_back({now + milliseconds(max<int64_t>(0, entry.second.expiresAt - wallNow)), entry.first,
+                                   entry.second.expiresAt});
+            }
+        }
+        for (const auto& expiry : pending) {
+            scheduleExpiry(get<1>(expiry), get<0>(expiry), get<2>(expiry));
+        }
+        if (snapshotInterval.count() > 0) {
+            snapshotThread = thread(&InventoryManager::runSnapshots, this, snapshotInterval);
+        }
+        return true;
+    }
+
+    // Writes every product and order to <directory>/snapshot and starts a
+    // new log generation, so recovery only replays what came after it.
+    // Mutations pause while the state is copied into memory, not while the
+    // copy is written out.
+    bool snapshot() {
+        if (!log) return false;
+        lock_guard<mutex> snapshotLock(snapshotMtx);
+        string image;
+        {
+            vector<unique_lock<mutex>> locks;
+            for (auto& shard : orderShards) locks.emplace_back(shard.mtx);
+            for (auto& stripe : stripes) locks.emplace_back(stripe);
+            shared_lock<shared_mutex> catalogueLock(catalogueMtx);
+
+            uint64_t generation;
+            if (!log->rotate(generation)) return false;
+            RecordWriter(image, EventType::SNAPSHOT_HEADER).put(generation).put((uint64_t)productIds.size()).done();
+            for (WarehouseId warehouse = 1; warehouse < warehouseNames.size(); warehouse++) {
+                RecordWriter(image, EventType::WAREHOUSE).put(warehouseNames[warehouse]).done();
+            }
+            for (ProductHandle handle = 0; handle < productIds.size(); handle++) {
+                RecordWriter writer(image, EventType::SNAPSHOT_PRODUCT);
+                writer.put(productIds[handle])
+                    .put(names[handle])
+                    .put((int32_t)blocked[handle].load())
+                    .put((int32_t)sold[handle].load())
+                    .put((uint32_t)stockByWarehouse[handle].size());
+                for (const auto& entry : stockByWarehouse[handle]) {
+                    writer.put(entry.warehouse).put((int32_t)entry.available);
+                }
+                writer.done();
+            }
+            for (const auto& shard : orderShards) {
+                for (const auto& entry : shard.orders) {
+                    image += encodeOrder(EventType::SNAPSHOT_ORDER, entry.first, entry.second);
+                }
+            }
+        }
+
+        // Written aside and renamed over the old one, so a crash mid-write
+        // still leaves the previous snapshot and its log generations intact.
+        string path = persistenceDirectory + "/snapshot";
+        string tmpPath = path + ".tmp";
+        int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        bool ok = writeAll(fd, image.data(), image.size()) && ::fsync(fd) == 0;
+        ::close(fd);
+        if (!ok || ::rename(tmpPath.c_str(), path.c_str()) != 0) return false;
+        int dirFd = ::open(persistenceDirectory.c_str(), O_RDONLY);
+        if (dirFd >= 0) {
+            ::fsync(dirFd);
+            ::close(dirFd);
+        }
+        return true;
     }
 };
 
-int main() {
+// Samples ranks 0..n-1 with probability proportional to 1 / (rank+1)^s.
+class ZipfDistribution {
+private:
+    vector<double> cdf;
+
+public:
+    ZipfDistribution(size_t n, double s) : cdf(n) {
+        double sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            sum += 1.0 / pow(i + 1, s);
+            cdf[i] = sum;
+        }
+        for (auto& c : cdf) c /= sum;
+    }
+
+    template <typename Rng>
+    size_t operator()(Rng& rng) {
+        double u = uniform_real_distribution<double>(0, 1)(rng);
+        return min<size_t>(lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin(), cdf.size() - 1);
+    }
+};
+
+// Order throughput against thread count on a Zipf-skewed catalogue: each
+// thread creates and confirms orders of 1-4 lines.
+void runOrderBenchmark() {
+    const size_t products = 10000;
+    const size_t ordersPerThread = 50000;
+    const unsigned maxThreads = max(8u, thread::hardware_concurrency());
+
+    for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+        InventoryManager manager(minutes(5), false);
+        for (size_t p = 0; p < products; p++) {
+            manager.createProduct(to_string(p), "P" + to_string(p), 1 << 30);
+        }
+        ZipfDistribution zipf(products, 0.99);
+
+        auto start = steady_clock::now();
+        vector<thread> workers;
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([&, t] {
+                mt19937_64 rng(t + 1);
+                ZipfDistribution localZipf = zipf;
+                for (size_t i = 0; i < ordersPerThread; i++) {
+                    size_t lines = 1 + rng() % 4;
+                    vector<string> productIds;
+                    vector<int> quantities;
+                    for (size_t l = 0; l < lines; l++) {
+                        productIds.push_back(to_string(localZipf(rng)));
+                        quantities.push_back(1);
+                    }
+                    string orderId = to_string(t) + "-" + to_string(i);
+                    if (manager.createOrder(productIds, quantities, orderId)) {
+                        manager.confirmOrder(orderId);
+                    }
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        double seconds = duration<double>(steady_clock::now() - start).count();
+        cout << "threads=" << threads << " orders/sec=" << (uint64_t)(threads * ordersPerThread / seconds) << endl;
+    }
+}
+
+// Restart time for a catalogue of the given size: a snapshot plus a log
+// tail of 10k reservations, recovered into a fresh manager.
+void runRecoveryBenchmark(size_t products) {
+    string directory = (filesystem::temp_directory_path() / "inventory-recovery-bench").string();
+    filesystem::remove_all(directory);
+    {
+        // Loaded before logging starts; enablePersistence snapshots it.
+        InventoryManager manager(minutes(5), false);
+        for (size_t p = 0; p < products; p++) {
+            manager.createProduct(to_string(p), "P" + to_string(p), 100);
+        }
+        manager.enablePersistence(directory, milliseconds(0));
+
+        vector<OrderRequest> requests;
+        for (size_t i = 0; i < 10000; i++) {
+            requests.push_back({"order-" + to_string(i), {to_string(i % products)}, {1}});
+        }
+        manager.createOrders(requests);
+    }
+
+    auto start = steady_clock::now();
+    InventoryManager manager(minutes(5), false);
+    bool ok = manager.enablePersistence(directory, milliseconds(0));
+    double seconds = duration<double>(steady_clock::now() - start).count();
+    cout << "products=" << products << " recovered=" << ok << " seconds=" << seconds << endl;
+    filesystem::remove_all(directory);
+}
+
+// Hammers one catalogue from many threads: each creates orders on a Zipf
+// skew and then confirms, releases or abandons them to the expiry thread.
+// An auditor checks available + blocked + sold == initial stock, with no
+// counter negative, on consistent cuts throughout the run and once more
+// after every reservation has expired. Returns false on any violation.
+bool runStressTest(unsigned threads, milliseconds runFor) {
+    const size_t products = 1000;
+    const int initialStock = 10000;
+    const milliseconds ttl(20);
+    InventoryManager manager(ttl, false);
+    for (size_t p = 0; p < products; p++) {
+        manager.createProduct(to_string(p), "P" + to_string(p), initialStock);
+    }
+    ZipfDistribution zipf(products, 0.99);
+
+    atomic<bool> running{true};
+    atomic<size_t> violations{0};
+    auto audit = [&](bool settled) {
+        vector<StockLevels> levels = manager.auditStock();
+        for (const auto& level : levels) {
+            bool balanced = level.available + level.blocked + level.sold == initialStock;
+            bool negative = level.available < 0 || level.blocked < 0 || level.sold < 0;
+            if (!balanced || negative || level.warehoused != level.available || (settled && level.blocked != 0)) {
+                violations++;
+            }
+        }
+    };
+    thread auditor([&] {
+        while (running) {
+            audit(false);
+            this_thread::sleep_for(milliseconds(5));
+        }
+    });
+
+    // Latencies of successful reservations, and units sold per product as
+    // seen by the callers, merged after the run.
+    vector<vector<double>> latencies(threads);
+    vector<vector<int>> soldByThread(threads, vector<int>(products, 0));
+    atomic<size_t> attempted{0};
+    auto start = steady_clock::now();
+    vector<thread> workers;
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            mt19937_64 rng(t + 1);
+            ZipfDistribution localZipf = zipf;
+            for (size_t i = 0; running; i++) {
+                size_t lines = 1 + rng() % 4;
+                vector<string> productIds;
+                vector<int> quantities;
+                for (size_t l = 0; l < lines; l++) {
+                    productIds.push_back(to_string(localZipf(rng)));
+                    quantities.push_back(1 + rng() % 3);
+                }
+                string orderId = to_string(t) + "-" + to_string(i);
+                auto begin = steady_clock::now();
+                bool reserved = manager.createOrder(productIds, quantities, orderId);
+                attempted++;
+                if (!reserved) continue;
+                latencies[t].push_back(duration<double, micro>(steady_clock::now() - begin).count());
+                switch (rng() % 4) {
+                case 0:
+                    // Left for the expiry thread.
+                    break;
+                case 1:
+                    manager.releaseBlockedInventory(orderId);
+                    break;
+                default:
+                    if (manager.confirmOrder(orderId)) {
+                        for (size_t l = 0; l < lines; l++) {
+                            soldByThread[t][stoul(productIds[l])] += quantities[l];
+                        }
+                    }
+                }
+            }
+        });
+    }
+    this_thread::sleep_for(runFor);
+    running = false;
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    double seconds = duration<double>(steady_clock::now() - start).count();
+    auditor.join();
+
+    // Let every abandoned reservation expire, then the books must close.
+    this_thread::sleep_for(ttl * 10);
+    audit(true);
+    vector<StockLevels> levels = manager.auditStock();
+    for (size_t p = 0; p < products; p++) {
+        int sold = 0;
+        for (const auto& perThread : soldByThread) {
+            sold += perThread[p];
+        }
+        if (sold != levels[p].sold) violations++;
+    }
+
+    vector<double> all;
+    for (const auto& perThread : latencies) {
+        all.insert(all.end(), perThread.begin(), perThread.end());
+    }
+    sort(all.begin(), all.end());
+    auto percentile = [&](double q) { return all.empty() ? 0.0 : all[min(all.size() - 1, (size_t)(q * all.size()))]; };
+    cout << "threads=" << threads << " attempts/sec=" << (uint64_t)(attempted / seconds)
+         << " reserved/sec=" << (uint64_t)(all.size() / seconds) << " p50_us=" << percentile(0.5)
+         << " p99_us=" << percentile(0.99) << " p999_us=" << percentile(0.999) << " violations=" << violations
+         << endl;
+    return violations == 0;
+}
+
+// Reservation latency for 50-line orders over 100 warehouses, each product
+// stocked thinly in a random fifth of them so most orders need splitting.
+void runAllocationBenchmark() {
+    const size_t products = 10000;
+    const size_t warehouses = 100;
+    const size_t orders = 20000;
+    InventoryManager manager(minutes(5), false);
+    manager.setPartialFulfillment(true);
+    for (size_t w = 1; w < warehouses; w++) {
+        manager.addWarehouse("W" + to_string(w));
+    }
+    mt19937_64 rng(1);
+    vector<StockDelta> deltas;
+    for (size_t p = 0; p < products; p++) {
+        manager.createProduct(to_string(p), "P" + to_string(p), 0);
+        for (size_t w = 0; w < warehouses / 5; w++) {
+            deltas.push_back({to_string(p), 1 << 20, (WarehouseId)(rng() % warehouses)});
+        }
+    }
+    manager.applyStockDeltas(deltas);
+
+    vector<double> latencies;
+    size_t shipments = 0;
+    for (size_t i = 0; i < orders; i++) {
+        vector<ProductHandle> handles;
+        vector<int> quantities;
+        for (size_t l = 0; l < 50; l++) {
+            handles.push_back(rng() % products);
+            quantities.push_back(1 + rng() % ((1 << 20) + (1 << 19)));
+        }
+        string orderId = to_string(i);
+        auto start = steady_clock::now();
+        manager.createOrderByHandle(handles, quantities, orderId);
+        latencies.push_back(duration<double, micro>(steady_clock::now() - start).count());
+
+        vector<Allocation> allocations = manager.getAllocations(orderId);
+        for (size_t a = 0; a < allocations.size(); a++) {
+            if (a == 0 || allocations[a].warehouse != allocations[a - 1].warehouse) shipments++;
+        }
+        manager.releaseBlockedInventory(orderId);
+    }
+    sort(latencies.begin(), latencies.end());
+    cout << "orders=" << orders << " p50_us=" << latencies[orders / 2] << " p99_us=" << latencies[orders * 99 / 100]
+         << " shipments/order=" << (double)shipments / orders << endl;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && string(argv[1]) == "bench") {
+        runOrderBenchmark();
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "stress") {
+        unsigned threads = argc > 2 ? stoul(argv[2]) : max(8u, thread::hardware_concurrency());
+        return runStressTest(threads, seconds(argc > 3 ? stoul(argv[3]) : 5)) ? 0 : 1;
+    }
+    if (argc > 1 && string(argv[1]) == "bench-allocation") {
+        runAllocationBenchmark();
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "bench-recovery") {
+        runRecoveryBenchmark(argc > 2 ? stoull(argv[2]) : 1000000);
+        return 0;
+    }
+
     InventoryManager manager;
+    manager.setAlertSink(make_shared<ConsoleAlertSink>());
 
     manager.createProduct("1", "P1", 2);
     manager.createProduct("2", "P2", 5);
     manager.createProduct("3", "P3", 4);
+    manager.setLowStockThreshold("3", 3);
 
     cout << "Inventory of P1: " << manager.getInventory("1") << endl;
     cout << "Inventory of P2: " << manager.getInventory("2") << endl;
@@ -115,5 +1786,22 @@ int main() {
     cout << "Final Inventory of P1: " << manager.getInventory("1") << endl;
     cout << "Final Inventory of P3: " << manager.getInventory("3") << endl;
 
+    auto deltaResults = manager.applyStockDeltas({{"1", 3}, {"2", -10}, {"4", 1}});
+    cout << "Stock deltas applied: " << count(deltaResults.begin(), deltaResults.end(), DeltaResult::APPLIED)
+         << "/" << deltaResults.size() << endl;
+
+    auto orderResults = manager.createOrders({{"2", {"1", "2"}, {2, 1}}, {"3", {"3"}, {5}}});
+    cout << "Orders reserved: " << count(orderResults.begin(), orderResults.end(), OrderResult::RESERVED)
+         << "/" << orderResults.size() << endl;
+
+    WarehouseId east = manager.addWarehouse("East");
+    manager.applyStockDeltas({{"2", 3, east}, {"1", 4, east}});
+    manager.setPartialFulfillment(true);
+    manager.createOrder({"1", "2"}, {5, 6}, "4");
+    for (const auto& allocation : manager.getAllocations("4")) {
+        cout << "Order 4 ships " << allocation.quantity << " of handle " << allocation.product << " from warehouse "
+             << allocation.warehouse << endl;
+    }
+
     return 0;
 }
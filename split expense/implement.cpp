@@ -11,6 +11,12 @@ public:
     }
 };
 
+// One transfer that settles part of the group's debts.
+struct Settlement {
+    string from, to;
+    double amount;
+};
+
 class ExpenseManager {
 private:
     unordered_map<string, User*> users;
@@ -99,6 +105,54 @@ public:
         }
         if (!found) cout << "No balances" << endl;
     }
+
+    // Collapses the pairwise balances into one net position per user, in
+    // whole cents so rounding cannot leave stray debts, then repeatedly
+    // settles the largest debtor against the largest creditor from two
+    // heaps. Each transfer clears at least one of them, so a group of n
+    // settles in at most n - 1 transfers, in O(entries + n log n).
+    vector<Settlement> simplifyDebts() {
+        unordered_map<string, long long> net;
+        for(auto &user: balances){
+            for(auto &debt: user.second){
+                if(debt.second > 0) {
+                    long long cents = llround(debt.second * 100);
+                    net[user.first] -= cents;
+                    net[debt.first] += cents;
+                }
+            }
+        }
+
+        vector<string> ids;
+        priority_queue<pair<long long, size_t> > creditors, debtors;
+        for(auto &position: net){
+            if(position.second > 0) creditors.push({position.second, ids.size()});
+            else if(position.second < 0) debtors.push({-position.second, ids.size()});
+            else continue;
+            ids.push_back(position.first);
+        }
+
+        vector<Settlement> settlements;
+        while(!creditors.empty() && !debtors.empty()){
+            auto creditor = creditors.top();
+            auto debtor = debtors.top();
+            creditors.pop();
+            debtors.pop();
+            long long cents = min(creditor.first, debtor.first);
+            settlements.push_back({ids[debtor.second], ids[creditor.second], cents / 100.0});
+            if(creditor.first > cents) creditors.push({creditor.first - cents, creditor.second});
+            if(debtor.first > cents) debtors.push({debtor.first - cents, debtor.second});
+        }
+        return settlements;
+    }
+
+    void showSimplifiedBalances(){
+        vector<Settlement> settlements = simplifyDebts();
+        for(auto &settlement: settlements){
+            cout<<settlement.from<<" pays "<<settlement.to<<":"<<fixed<<setprecision(2)<<settlement.amount<<endl;
+        }
+        if (settlements.empty()) cout << "No balances" << endl;
+    }
 };
 
 int main(){
@@ -121,6 +175,7 @@ int main(){
     
     manager.processExpense("u4", 1200, 4, {"u1", "u2", "u3", "u4"}, "PERCENT", {40, 20, 20, 20});
     manager.showUserBalance("u1");
+    manager.showSimplifiedBalances();
 
     return 0;
 }